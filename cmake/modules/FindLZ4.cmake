@@ -0,0 +1,38 @@
+# - Find LZ4
+# Finds the LZ4 compression library.
+#
+#  LZ4_INCLUDE_DIR - Where lz4.h is
+#  LZ4_LIBRARY     - The LZ4 library
+#  LZ4_FOUND       - True if LZ4 was found.
+
+FIND_PATH( LZ4_INCLUDE_DIR NAMES lz4.h
+	PATHS /usr/local/include
+	/usr/include
+	DOC "Path in which the file lz4.h is located." )
+MARK_AS_ADVANCED(LZ4_INCLUDE_DIR)
+
+FIND_LIBRARY( LZ4_LIBRARY NAMES lz4
+	PATHS /usr/local/lib
+	/usr/lib
+	DOC "The LZ4 library." )
+MARK_AS_ADVANCED(LZ4_LIBRARY)
+
+# Copy the results to the output variables.
+IF(LZ4_INCLUDE_DIR AND LZ4_LIBRARY)
+	SET(LZ4_FOUND 1)
+ELSE(LZ4_INCLUDE_DIR AND LZ4_LIBRARY)
+	SET(LZ4_FOUND 0)
+	SET(LZ4_INCLUDE_DIR)
+	SET(LZ4_LIBRARY)
+ENDIF(LZ4_INCLUDE_DIR AND LZ4_LIBRARY)
+
+# Report the results.
+IF(NOT LZ4_FOUND)
+	SET(LZ4_DIR_MESSAGE
+		"LZ4 was not found, chunks will be saved without it.")
+	IF(LZ4_FIND_REQUIRED)
+		MESSAGE(FATAL_ERROR "${LZ4_DIR_MESSAGE}")
+	ELSEIF(NOT LZ4_FIND_QUIETLY)
+		MESSAGE(STATUS "${LZ4_DIR_MESSAGE}")
+	ENDIF(LZ4_FIND_REQUIRED)
+ENDIF(NOT LZ4_FOUND)
@@ -16,6 +16,19 @@ enum {
 	FACE_ALL	= FACE_TOP | FACE_BOTTOM | FACE_LEFT | FACE_RIGHT | FACE_FORWARD | FACE_BACK
 };
 
+/**
+ * Index of each face, the bit position of its FACE_ flag.
+ */
+enum {
+	FACE_INDEX_TOP	= 0,
+	FACE_INDEX_BOTTOM	= 1,
+	FACE_INDEX_LEFT	= 2,
+	FACE_INDEX_RIGHT	= 3,
+	FACE_INDEX_FORWARD	= 4,
+	FACE_INDEX_BACK	= 5,
+	FACE_COUNT	= 6
+};
+
 enum {
 	BMASK_VISFLAGS = ( (1<<0) | (1<<1) | (1<<2) | (1<<3) | (1<<4) | (1<<5) )
 };
@@ -32,15 +45,18 @@ struct BlockContext
 	World* world;
 };
 
+/**
+ * A block type.
+ *
+ * One instance of each type is shared by every voxel of that type (see
+ * BaseBlockFactory::getBlockType), so blocks can't store anything about a
+ * single voxel; per-voxel data lives in the Chunk.
+ */
 class BaseBlock
 {
-protected:
-	unsigned char mDataFlags;
-	
-	void _setPosition( unsigned short x, unsigned  short y, unsigned short z );
 public:
 	BaseBlock();
-	~BaseBlock(void);
+	virtual ~BaseBlock(void);
 
 	virtual void created() = 0;
 	virtual void hit() = 0;
@@ -60,6 +76,12 @@ public:
 	 */
 	virtual bool isSolid() { return true; }
 
+	/**
+	 * Returns true if this block has per-instance state, and so can't be
+	 * shared between voxels in a chunk's palette.
+	 */
+	virtual bool hasState() { return false; }
+
 	/**
 	 * Returns true if this block needs to think
 	 */
@@ -77,27 +99,6 @@ public:
 	virtual void connectedChange( short face );
 	virtual void getTextureCoords( short face, short &x, short &y );
 
-	/**
-	 * Updates the viewflags for this block
-	 * @param flags the new bitfield
-	 */
-	void updateVisFlags(unsigned int flags);
-
-	/**
-	 * Returns the viewflags for this block
-	 */
-	unsigned short getVisFlags();
-
-	/**
-	 * Appends this block's data to a stream.
-	 */
-	void appendToStream( std::ofstream& stream );
-
-	/**
-	 * Reads the data for this block from a stream
-	 */
-	void readFromStream( std::ifstream& stream );
-
 	virtual std::string getType() = 0;
 
 	/*short getX();
@@ -1,14 +1,44 @@
 #ifndef _BASETRIANGULATOR_H_
 #define _BASETRIANGULATOR_H_
 #include "prerequisites.h"
+#include "ChunkNeighbourhood.h"
 
 class TerrainGeometry;
 class Chunk;
 
 class BaseTriangulator
 {
+protected:
+	/**
+	 * Corners of a single block's face, in the order their vertices are emitted.
+	 */
+	static const float FaceCorners[6][4][3];
+	
+	/**
+	 * Returns how shadowed each corner of a block's face is by the blocks
+	 * around it, from 0 for open to 3 for closed in. Two bits per corner,
+	 * in FaceCorners order.
+	 */
+	static uint8_t faceOcclusion( const Magnetite::ChunkNeighbourhood& hood, long x, long y, long z, int face );
+	
+	/**
+	 * Returns true if a quad should be split along the diagonal between its
+	 * second and fourth corners rather than its first and third. The split
+	 * runs between the darker pair, so the shadow fades the same way
+	 * whichever way the quad is turned.
+	 */
+	static inline bool flipQuad( uint8_t ao )
+	{
+		return ( ( ao >> 2 ) & 3 ) + ( ( ao >> 6 ) & 3 ) > ( ao & 3 ) + ( ( ao >> 4 ) & 3 );
+	}
+	
 public:
-	virtual void triangulateChunk( TerrainGeometry* geom, Chunk* chunk ) = 0;
+	/**
+	 * Builds the chunk's mesh into the geometry, the chunk must be locked.
+	 * @param hood Copy of the chunk and the blocks around it, everything
+	 * but the list of visible blocks is read from here
+	 */
+	virtual void triangulateChunk( TerrainGeometry* geom, Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood ) = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,14 +1,27 @@
 #ifndef _BLOCKFACTORY_H_
 #define _BLOCKFACTORY_H_
 #include "prerequisites.h"
+#include "BaseBlock.h"
 
 class BaseBlockFactory {
 protected:
 	std::string typeName;
+	
+	/**
+	 * Shared, immutable instance of this block type.
+	 */
+	BaseBlock* blockType;
 public:
 	BaseBlockFactory( std::string type );
+	virtual ~BaseBlockFactory();
 	std::string getType();
 	virtual BaseBlock* create();
+	
+	/**
+	 * Returns the shared instance of this block type, per-voxel data lives in
+	 * the chunk so every voxel of this type can point at the same block.
+	 */
+	BaseBlock* getBlockType();
 };
 
 class BaseGame;
@@ -80,12 +93,28 @@ public:
 	}
 	
 	/**
-	 * Creates a factory of the specifed type
+	 * Returns the shared instance of the given block type
+	 */
+	BaseBlock* getBlockType( const std::string& type ) {
+		BlockFactoryList::iterator it = blockFactoryList.find( type );
+		if( it != blockFactoryList.end() ) {
+			return (*it).second->getBlockType();
+		}
+		return NULL;
+	}
+	
+	/**
+	 * Returns a block of the specified type: the shared type instance, or a
+	 * new instance if the type keeps per-instance state.
 	 */
 	BaseBlock* createBlock( std::string type ) {
 		BlockFactoryList::iterator it = blockFactoryList.find( type );
 		if( it != blockFactoryList.end() ) {
-			return (*it).second->create();
+			BaseBlock* b = (*it).second->getBlockType();
+			if( b != NULL && b->hasState() ) {
+				return (*it).second->create();
+			}
+			return b;
 		}
 		return NULL;
 	}
@@ -93,7 +122,7 @@ public:
 
 template<class T> class GenericBlockFactory : BaseBlockFactory {
 public:
-	GenericBlockFactory( std::string type ) : BaseBlockFactory( type ) { }
+	GenericBlockFactory( std::string type ) : BaseBlockFactory( type ) { blockType = create(); }
 	virtual BaseBlock* create() { return new T; }
 };
 
@@ -0,0 +1,176 @@
+#ifndef _BLOCKSTORAGE_H_
+#define _BLOCKSTORAGE_H_
+#include "prerequisites.h"
+
+namespace Magnetite
+{
+	/**
+	 * @class BlockStorage
+	 *
+	 * Palette compressed storage for the blocks of a single chunk.
+	 *
+	 * Every voxel stores an index into a small palette of block types, the
+	 * indices are bit-packed into 64 bit words and widen from 1 to 16 bits
+	 * as the palette grows. A chunk that is nothing but air allocates no index
+	 * array at all.
+	 *
+	 * Palette entries point at the shared block types owned by the block
+	 * factories (see BaseBlockFactory::getBlockType) and are never deleted.
+	 * Blocks that carry per-instance state (see BaseBlock::hasState) can't share
+	 * a palette entry, they are owned by the storage and kept in a side table
+	 * keyed by voxel index.
+	 */
+	class BlockStorage
+	{
+	public:
+		typedef uint16_t PaletteIndex;
+
+		/**
+		 * Palette index used for empty voxels.
+		 */
+		static const PaletteIndex EmptyIndex = 0;
+
+	protected:
+
+		struct PaletteEntry
+		{
+			/**
+			 * The block type shared by every voxel using this entry,
+			 * null for the empty and stateful entries.
+			 */
+			BlockPtr block;
+
+			/**
+			 * Number of voxels using this entry.
+			 */
+			size_t references;
+		};
+		typedef std::vector<PaletteEntry> Palette;
+
+		/**
+		 * The palette, entry 0 is always the empty block.
+		 */
+		Palette mPalette;
+
+		/**
+		 * Palette entries that are no longer referenced and can be reused.
+		 */
+		std::vector<PaletteIndex> mFreeEntries;
+
+		/**
+		 * Palette entry shared by all stateful blocks, 0 if there isn't one yet.
+		 */
+		PaletteIndex mStatefulIndex;
+
+		/**
+		 * Blocks that have their own state, keyed by voxel index.
+		 */
+		BlockList mStateful;
+
+		/**
+		 * Bit-packed palette indices, null until something other than air is stored.
+		 */
+		uint64_t* mIndices;
+
+		/**
+		 * Number of bits per index, always a power of two.
+		 */
+		uint8_t mBits;
+
+		/**
+		 * log2( indices per word ), for cheap word addressing.
+		 */
+		uint8_t mShift;
+
+		/**
+		 * Re-packs the index array with the given number of bits per entry.
+		 */
+		void _resize( uint8_t bits );
+
+		/**
+		 * Returns the palette entry for the block, creating one if needed.
+		 */
+		PaletteIndex _acquireEntry( BlockPtr block );
+
+		/**
+		 * Drops a reference to a palette entry, freeing it once it is unused.
+		 */
+		void _releaseEntry( PaletteIndex entry );
+
+		/**
+		 * Writes the raw palette index for a voxel.
+		 */
+		void _setIndex( size_t index, PaletteIndex entry );
+
+	public:
+
+		BlockStorage();
+
+		~BlockStorage();
+
+		/**
+		 * Returns the raw palette index for a voxel.
+		 */
+		inline PaletteIndex getIndex( size_t index ) const
+		{
+			if( mIndices == nullptr ) return EmptyIndex;
+			uint64_t word = mIndices[ index >> mShift ];
+			size_t offset = ( index & ( ( 1 << mShift ) - 1 ) ) * mBits;
+			return ( word >> offset ) & ( ( 1ull << mBits ) - 1 );
+		}
+
+		/**
+		 * Returns the block at the given voxel index.
+		 */
+		inline BlockPtr get( size_t index ) const
+		{
+			PaletteIndex entry = getIndex( index );
+			if( entry == EmptyIndex ) return NULL;
+			if( entry == mStatefulIndex )
+			{
+				auto it = mStateful.find( index );
+				return it != mStateful.end() ? it->second : NULL;
+			}
+			return mPalette[ entry ].block;
+		}
+
+		/**
+		 * Stores a block at the given voxel index, replacing any block already
+		 * there.
+		 *
+		 * Stateless blocks are expected to be shared block types, stateful blocks
+		 * are owned (and eventually deleted) by the storage.
+		 * @return the block that now represents the voxel.
+		 */
+		BlockPtr set( size_t index, BlockPtr block );
+
+		/**
+		 * Removes the block at the given index.
+		 */
+		void remove( size_t index );
+
+		/**
+		 * Fills one word for each row of CHUNK_WIDTH voxels along x, in voxel
+		 * index order. Bits are set in solid for every block and in opaque
+		 * for blocks that can't be seen through.
+		 */
+		void getRowMasks( uint32_t* solid, uint32_t* opaque ) const;
+
+		/**
+		 * Returns the number of palette entries in use, including air.
+		 */
+		size_t getPaletteSize() const;
+
+		/**
+		 * Returns the current width of the packed indices, in bits.
+		 */
+		uint8_t getIndexBits() const;
+
+		/**
+		 * Returns an estimate of the memory used by the storage, in bytes.
+		 */
+		size_t getMemoryUsage() const;
+	};
+};
+
+#endif
@@ -7,7 +7,7 @@ class Chunk;
 class BlockTriangulator : public BaseTriangulator
 {
 public:
-	virtual void triangulateChunk( TerrainGeometry* geom, Chunk* chunk );
+	virtual void triangulateChunk( TerrainGeometry* geom, Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood );
 };
 
 #endif
\ No newline at end of file
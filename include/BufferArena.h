@@ -0,0 +1,126 @@
+#ifndef _BUFFERARENA_H_
+#define _BUFFERARENA_H_
+#include "prerequisites.h"
+#include <map>
+#include <deque>
+
+namespace Magnetite
+{
+	/**
+	 * @class BufferArena
+	 *
+	 * One large GL buffer that is handed out in slices, so geometry can be
+	 * uploaded without the driver allocating storage for each mesh.
+	 *
+	 * When ARB_buffer_storage is available the buffer is persistently mapped
+	 * and uploads are a memcpy, otherwise they go through glBufferSubData.
+	 * Freed slices are only reused once the GPU has finished the frame they
+	 * were freed in.
+	 *
+	 * All methods must be called on the render thread.
+	 */
+	class BufferArena
+	{
+	protected:
+		
+		GLenum mTarget;
+		
+		GLuint mBuffer;
+		
+		size_t mCapacity;
+		
+		size_t mAlignment;
+		
+		/**
+		 * Persistently mapped storage, NULL if uploads use glBufferSubData.
+		 */
+		char* mMapped;
+		
+		/**
+		 * Free slices keyed by offset, adjacent slices are always merged.
+		 */
+		std::map<size_t, size_t> mFree;
+		
+		/**
+		 * Bytes currently allocated.
+		 */
+		size_t mUsed;
+		
+		typedef std::vector<std::pair<size_t, size_t>> SliceList;
+		
+		/**
+		 * Slices freed since the last endFrame.
+		 */
+		SliceList mFreed;
+		
+		/**
+		 * Slices waiting for the GPU to pass the fence of the frame they
+		 * were freed in.
+		 */
+		struct PendingFree
+		{
+			GLsync fence;
+			SliceList slices;
+		};
+		std::deque<PendingFree> mPending;
+		
+		/**
+		 * Returns a slice to the free list, merging it with its neighbours.
+		 */
+		void _release( size_t offset, size_t size );
+		
+		/**
+		 * Releases the pending slices whose fences have been passed.
+		 */
+		void _reclaim();
+	
+	public:
+		
+		/**
+		 * @param target Buffer binding target, eg. GL_ARRAY_BUFFER
+		 * @param capacity Size of the buffer in bytes
+		 * @param alignment Slices start at multiples of this many bytes
+		 */
+		BufferArena( GLenum target, size_t capacity, size_t alignment );
+		
+		~BufferArena();
+		
+		/**
+		 * Finds space for size bytes, returns false if the arena is too full.
+		 */
+		bool allocate( size_t size, size_t& offset );
+		
+		/**
+		 * Copies data into an allocated slice.
+		 */
+		void upload( size_t offset, const void* data, size_t size );
+		
+		/**
+		 * Frees a slice, it is reused after the GPU finishes this frame.
+		 */
+		void free( size_t offset, size_t size );
+		
+		/**
+		 * Fences the slices freed during this frame, call once the frame's
+		 * draw calls have been submitted.
+		 */
+		void endFrame();
+		
+		/**
+		 * Returns the GL buffer name.
+		 */
+		GLuint getName();
+		
+		/**
+		 * Returns the number of bytes allocated.
+		 */
+		size_t getUsedSize();
+		
+		/**
+		 * Returns the size of the buffer in bytes.
+		 */
+		size_t getCapacity();
+	};
+};
+
+#endif
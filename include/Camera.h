@@ -14,6 +14,11 @@ protected:
 	Vector3 mPosition;
 
 	Frustum mViewFrustum;
+	
+	/**
+	 * Updates the paging view cone to match the camera
+	 */
+	void _updatePagingView();
 public:
 	Camera( World* world );
 	~Camera(void);
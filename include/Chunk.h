@@ -2,16 +2,56 @@
 #define _CHUNK_H_
 #include "prerequisites.h"
 #include "Region.h"
+#include "BlockStorage.h"
+#include "ChunkNeighbourhood.h"
 #include <mutex>
+#include <atomic>
 
 // for standard size types
 #include <cstdint>
 
 class TerrainGeometry;
 class World;
+class BaseTriangulator;
 
 typedef std::map<size_t, BlockPtr> BlockList;
 
+/**
+ * @struct VisibleBlockList
+ * The blocks of a chunk with at least one visible face, as parallel arrays
+ * in block index order. Rebuilt as a whole by each visibility pass so the
+ * triangulators can read it straight through.
+ */
+struct VisibleBlockList
+{
+	/**
+	 * Index of each block in the chunk.
+	 */
+	std::vector<uint16_t> indices;
+	
+	/**
+	 * FACE_ flags of each block's visible faces.
+	 */
+	std::vector<uint8_t> faces;
+	
+	inline size_t size() const
+	{
+		return indices.size();
+	}
+	
+	inline void clear()
+	{
+		indices.clear();
+		faces.clear();
+	}
+	
+	inline void push_back( uint16_t index, uint8_t faceFlags )
+	{
+		indices.push_back( index );
+		faces.push_back( faceFlags );
+	}
+};
+
 class Chunk
 {
 protected:
@@ -21,14 +61,14 @@ protected:
 	World*	mWorld;
 	
 	/**
-	 * Array of blocks
+	 * Palette compressed block storage
 	 */
-	BlockArray	mBlocks;
+	Magnetite::BlockStorage	mBlocks;
 	
 	/**
-	 * List of blocks that are visible
+	 * Blocks that are visible
 	 */
-	BlockList	mVisibleBlocks;
+	VisibleBlockList	mVisibleBlocks;
 
 	/**
 	 * Index of the chunk in the world
@@ -39,6 +79,13 @@ protected:
 	 * Array of light values
 	 */
 	LightIndex* mLightValues;
+
+	
+	/**
+	 * Fluid level of each block as a percentage, only allocated once a
+	 * level other than full has been set.
+	 */
+	uint8_t* mFluidLevels;
 	
 	/**
 	 * Number of visible faces.
@@ -46,9 +93,27 @@ protected:
 	size_t	mVisibleFaces;
 	
 	/**
-	 * The chunk's geometry
+	 * The chunk's geometry at each level of detail, replaced as a whole
+	 * when a new mesh is built so the renderer can read it without locking
+	 * the chunk.
+	 */
+	std::atomic<TerrainGeometry*>	mGeometry[CHUNK_LOD_LEVELS];
+	
+	/**
+	 * Set while a mesh job for this chunk is queued or running.
+	 */
+	std::atomic<bool> mMeshing;
+	
+	/**
+	 * Set when the chunk needs a new mesh, cleared when the job is queued.
+	 */
+	bool mMeshRequested;
+	
+	/**
+	 * Set by the renderer when it would draw a coarser level of detail
+	 * than has been built.
 	 */
-	TerrainGeometry*	mGeometry;
+	std::atomic<bool> mLodRequested;
 
 	/**
 	 * Allocates the array of a given size
@@ -78,6 +143,27 @@ protected:
 	 */
 	size_t mNumBlocks;
 	
+	/**
+	 * Incremented whenever the chunk's blocks or light change.
+	 */
+	uint32_t mGeneration;
+	
+	/**
+	 * Generation the chunk was at when it was last loaded, generated or saved.
+	 */
+	uint32_t mSavedGeneration;
+	
+	/**
+	 * One bit for each pair of faces that are connected through
+	 * non-opaque blocks, see isConnected.
+	 */
+	std::atomic<uint32_t> mConnectivity;
+	
+	/**
+	 * The last world visibility pass that reached this chunk.
+	 */
+	std::atomic<uint32_t> mVisibleStamp;
+	
 	/**
 	 * Threading lock
 	 *  ensures that only one thread is doing something with this chunk.
@@ -91,13 +177,15 @@ public:
 	enum {
 		DataUpdated = 1, // Data has been updated, Visibility check needed
 		MeshInvalid = 2, // Data has changed, mesh should be updated.
-		SkipLight = 4 // Skips updating lighting for one update.
+		SkipLight = 4, // Skips updating lighting for one update.
+		Detached = 8 // Chunk is being built off-thread and isn't in the world yet.
 	};
 	
 	/**
-	 * Method for getting the block directly from us if it's inside this chunk
+	 * Method for getting the block directly from us if it's inside this chunk,
+	 * detached chunks treat everything outside themselves as empty.
 	 */
-	inline BaseBlock* getBlockAtWorld( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+	BaseBlock* getBlockAtWorld( ChunkScalar x, ChunkScalar y, ChunkScalar z );
 
 	Chunk( ChunkIndex index, World*  world );
 	~Chunk();
@@ -135,15 +223,16 @@ public:
 	 */
 	inline void setBlockAt( BlockPtr block, ChunkScalar index )
 	{
-		if( index > CHUNK_SIZE || index < 0 ) return;
-		if( mBlocks[ index ] != NULL )
+		if( index >= CHUNK_SIZE || index < 0 ) return;
+		if( mBlocks.getIndex( index ) != Magnetite::BlockStorage::EmptyIndex )
 		{
 			removeBlockAt( index );
 		}
 		// Lock here to avoid locking the thread.
 		getMutex().lock();
 		mNumBlocks++;
-		mBlocks[ index ] = block;
+		mGeneration++;
+		mBlocks.set( index, block );
 		_raiseChunkFlag( DataUpdated );
 		getMutex().unlock();
 	}
@@ -173,14 +262,24 @@ public:
 	inline BlockPtr getBlockAt( const size_t index )
 	{
 		// No bounds checking, goota be careful.
-		return mBlocks[ index ];
+		return mBlocks.get( index );
 	}
 
 
 	/**
-	 * Returns all of the blocks
+	 * Returns the block storage
+	 */
+	Magnetite::BlockStorage& getBlocks();
+	
+	/**
+	 * Returns the fluid level of the block at the given index, 0 - 100.
 	 */
-	BlockPtr* getBlocks();
+	float getFluidLevel( const size_t index );
+	
+	/**
+	 * Sets the fluid level of the block at the given index, 0 - 100.
+	 */
+	void setFluidLevel( const size_t index, float level );
 
     /**
      * Returns the number of visisble faces this chunk has
@@ -190,7 +289,7 @@ public:
 	/**
 	 * Returns the list of visible blocks
 	 */
-	BlockList& getVisibleBlocks();
+	VisibleBlockList& getVisibleBlocks();
 
 	/**
 	 * Retuns true if there's a block next to the given position
@@ -201,8 +300,10 @@ public:
 	 * Sets the light value at the given pointer
 	 */
 	void setLightLevel( LightIndex value, short x, short y, short z ) {
-		if( x >= 0 && x < CHUNK_WIDTH && y >= 0 && y < CHUNK_HEIGHT && z >= 0 && z < CHUNK_WIDTH )
+		if( x >= 0 && x < CHUNK_WIDTH && y >= 0 && y < CHUNK_HEIGHT && z >= 0 && z < CHUNK_WIDTH ) {
 			mLightValues[ BLOCK_INDEX_2( x, y, z ) ] = value;
+			mGeneration++;
+		}
 	}
 	
 	/**
@@ -211,6 +312,7 @@ public:
 	void setLightLevel( LightIndex value, ChunkScalar ind ) {
 		if( ind >= 0 && ind < CHUNK_SIZE ) { 
 			mLightValues[ ind ] = value;
+			mGeneration++;
 		}
 	}
 	
@@ -236,8 +338,9 @@ public:
 	
 	/**
 	 * Returns a pointer to this chunk's geometry
+	 * @param level Level of detail, 0 is full detail
 	 */
-	Geometry* getGeometry();
+	TerrainGeometry* getGeometry( size_t level = 0 );
 	
 	/**
 	 * Requests that the chunk re-generate
@@ -245,29 +348,75 @@ public:
 	void requestGenerate();
 	
 	/**
-	 * Generates the chunk's actual geometry
+	 * Builds the chunk's mesh and physics with the given triangulator,
+	 * and the lower detail meshes, then publishes them. Runs on a worker
+	 * thread.
+	 * @param hood The neighbours' edges, gathered on the world thread when
+	 * the mesh was requested. The chunk itself is copied into it here.
+	 * @param lods Build the lower detail meshes too, otherwise any old ones
+	 * are dropped as they no longer match the chunk.
 	 */
-	void generate();
+	void generate( BaseTriangulator* triangulator, Magnetite::ChunkNeighbourhood& hood, bool lods );
 	
 	/**
-	 * Generates the geometry for this chunk's mesh.
+	 * Returns a new geometry for this chunk's mesh, the chunk must be locked.
+	 * @param hood Copy of the chunk and its neighbours' edges
 	 */
-	void generateGeometry();
+	TerrainGeometry* generateGeometry( BaseTriangulator* triangulator, const Magnetite::ChunkNeighbourhood& hood );
 	
 	/**
-	 * Generates the light data for this chunk
+	 * Generates the light data for this chunk, the chunk must be locked.
+	 * @return false if a neighbour was locked, nothing is changed and it
+	 * should be tried again later
 	 */
-	void generateLighting();
+	bool generateLighting();
 	
 	/**
-	 * Generates the chunk's physical geometry
+	 * Generates the chunk's physical geometry from the given mesh
 	 */
-	void generatePhysics();
+	void generatePhysics( TerrainGeometry* geometry );
 	
 	/**
-	 * Updates the visibility flags of each block
+	 * Returns true while a mesh for this chunk is being built.
+	 */
+	bool isMeshing();
+	
+	/**
+	 * Asks for the lower detail meshes to be built with the next mesh.
+	 * Safe to call from the render thread.
+	 */
+	void requestLod();
+	
+	/**
+	 * Rebuilds the list of visible blocks, working a whole row of blocks at
+	 * a time on bitmasks.
 	 */
 	void updateVisibility();
+	
+	/**
+	 * Fills one word per row of the layer of blocks on a face, with a bit
+	 * set for each opaque block. Words and bits follow the chunk's axes in
+	 * the order x, y, z, skipping the face's own axis: bits are the lower of
+	 * the remaining axes and words the higher.
+	 */
+	void _getOpaqueSlice( int face, uint32_t* slice );
+	
+	/**
+	 * Returns true if something could be seen through this chunk from one
+	 * face to the other, faces are FACE_INDEX_* values.
+	 */
+	bool isConnected( int faceA, int faceB );
+	
+	/**
+	 * Flood fills the non-opaque blocks to find which faces are connected.
+	 */
+	void _updateConnectivity();
+	
+	/**
+	 * Returns or sets the last world visibility pass that reached the chunk.
+	 */
+	uint32_t _getVisibleStamp();
+	void _setVisibleStamp( uint32_t stamp );
 
 	/**
 	 * Updates the chunk
@@ -294,6 +443,24 @@ public:
 	 */
     const size_t getBlockCount();
 	
+	/**
+	 * Returns the chunk's modification generation, which changes whenever
+	 * its blocks or light do.
+	 */
+	uint32_t getGeneration();
+	
+	/**
+	 * Returns true if the chunk has changed since it was last loaded,
+	 * generated or saved.
+	 */
+	bool isModified();
+	
+	/**
+	 * Records that the chunk's data at the given generation is stored, or
+	 * can be generated again.
+	 */
+	void _markSaved( uint32_t generation );
+	
 	/**
 	 * Returns the mutex for this chunk
 	 */
@@ -0,0 +1,63 @@
+#ifndef _CHUNKCODEC_H_
+#define _CHUNKCODEC_H_
+#include "prerequisites.h"
+#include <functional>
+
+namespace Magnetite
+{
+	/**
+	 * Callback for a run of voxels sharing a value, in BLOCK_INDEX_2 order.
+	 */
+	typedef std::function<void ( size_t start, size_t count, uint32_t value )> ChunkRunCallback;
+
+	/**
+	 * @class ChunkCodec
+	 *
+	 * Encodes chunk block ids and light values for storage.
+	 *
+	 * Encoded chunks start with a small versioned header. Empty chunks are just
+	 * the header and uniform chunks add a single value. Anything else is run
+	 * length coded in BLOCK_INDEX_2 order, which keeps rows of the same block
+	 * together, and if the build has LZ4 the runs are compressed further. The
+	 * header says whether LZ4 was used, so builds without it can still read
+	 * anything they wrote themselves.
+	 *
+	 * The raw arrays written by older versions are still decoded.
+	 */
+	class ChunkCodec
+	{
+	public:
+
+		/**
+		 * Current encoding version.
+		 */
+		static const uint8_t Version = 1;
+
+		enum Form {
+			Empty = 0, // All air and unlit, no payload.
+			Uniform = 1, // One block id and light value for the whole chunk.
+			RunLength = 2 // Block runs followed by light runs.
+		};
+
+		enum Flags {
+			CompressedLZ4 = 1
+		};
+
+		/**
+		 * Encodes a chunk.
+		 * @param blocks Block id of each voxel, 0 for air.
+		 * @param light Light value of each voxel.
+		 * @param out Receives the encoded data.
+		 */
+		static void encode( const uint32_t* blocks, const LightIndex* light, std::vector<char>& out );
+
+		/**
+		 * Decodes a chunk, reporting runs of block ids and light values.
+		 * Runs of air are reported too.
+		 * @return false if the data is invalid or can't be read by this build.
+		 */
+		static bool decode( const char* data, size_t length, const ChunkRunCallback& blocks, const ChunkRunCallback& light );
+	};
+};
+
+#endif
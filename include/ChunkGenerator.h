@@ -7,9 +7,21 @@ class World;
 
 class ChunkGenerator
 {
+public:
+	/**
+	 * Octaves of noise summed for the terrain height.
+	 */
+	static const int HeightOctaves = 8;
+
 protected:
 	long mSeed;
 
+	/**
+	 * Sample spacing and weight of each height octave.
+	 */
+	float mOctaveScale[HeightOctaves];
+	float mOctaveAmplitude[HeightOctaves];
+
 public:
 	ChunkGenerator( long seed );
 	~ChunkGenerator();
@@ -20,6 +32,16 @@ public:
 	float interpolatedNoise( float x, float y );
 	float smooth( float x, float y );
 
+	/**
+	 * Sums the height octaves for a CHUNK_WIDTH x CHUNK_WIDTH grid of
+	 * columns, the same as interpolatedNoise per column but each octave's
+	 * lattice is only smoothed once for the whole grid.
+	 * @param x World X of the first column.
+	 * @param z World Z of the first column.
+	 * @param heights Receives the noise of each column, indexed z * CHUNK_WIDTH + x.
+	 */
+	void heightMap( long x, long z, float* heights );
+
 	/**
 	 * This is partical deprecated.
 	 * \deprecated Use fillRegion instead
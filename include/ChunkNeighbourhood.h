@@ -0,0 +1,128 @@
+#ifndef _CHUNKNEIGHBOURHOOD_H_
+#define _CHUNKNEIGHBOURHOOD_H_
+#include "prerequisites.h"
+
+class Chunk;
+
+namespace Magnetite
+{
+	/**
+	 * @class ChunkNeighbourhood
+	 *
+	 * A copy of a chunk and the layer of blocks around it, taken from the
+	 * 26 chunks that touch it, in padded arrays where each axis runs from
+	 * -1 to CHUNK_WIDTH. Meshing and lighting read everything from here
+	 * instead of going through the World, so they never see a neighbour
+	 * half way through an edit.
+	 *
+	 * Opacity and light are kept for every position. Blocks are only kept
+	 * for the chunk itself, as a neighbour's blocks may be deleted once its
+	 * lock is released. Positions in chunks that aren't loaded are empty
+	 * and fully lit, the same as the World reports for them.
+	 *
+	 * Neighbours are copied first with gatherBorder on the world thread,
+	 * the only thread that adds and removes chunks, so none can be deleted
+	 * while it is copied. The chunk itself is copied with gatherChunk while
+	 * it is locked, which may happen later on a worker.
+	 */
+	class ChunkNeighbourhood
+	{
+	public:
+
+		/**
+		 * Width of the padded arrays along each axis.
+		 */
+		static const int Width = CHUNK_WIDTH + 2;
+
+		/**
+		 * Returns the index of a chunk position in the padded arrays.
+		 */
+		static inline size_t index( long x, long y, long z )
+		{
+			return ( ( z + 1 ) * Width + ( y + 1 ) ) * Width + ( x + 1 );
+		}
+
+	protected:
+
+		std::vector<BlockPtr> mBlocks;
+		std::vector<uint8_t> mOpaque;
+		std::vector<LightIndex> mLight;
+
+		/**
+		 * One bit for each of the 27 chunks copied, see neighbourBit.
+		 */
+		uint32_t mLoaded;
+
+		/**
+		 * Returns the bit in mLoaded for the chunk at an offset.
+		 */
+		static inline uint32_t neighbourBit( int dx, int dy, int dz )
+		{
+			return 1u << ( ( dz + 1 ) * 9 + ( dy + 1 ) * 3 + ( dx + 1 ) );
+		}
+
+		/**
+		 * Copies the part of a chunk that lies inside the padded arrays.
+		 * @param dx, dy, dz Offset of the chunk from the one being copied.
+		 * @param blocks Copy the block pointers as well.
+		 */
+		void _copy( Chunk* chunk, int dx, int dy, int dz, bool blocks );
+
+	public:
+
+		ChunkNeighbourhood();
+
+		/**
+		 * Copies the layer of blocks around the chunk from its loaded
+		 * neighbours, try_locking each one in turn so it is safe while
+		 * another chunk is locked. Detached chunks have no neighbours.
+		 * Only call this from the world thread.
+		 * @return false if a neighbour was locked, try again later.
+		 */
+		bool gatherBorder( Chunk* chunk );
+
+		/**
+		 * Copies the edge of a single neighbour, which must be locked by the
+		 * caller.
+		 * @param dx, dy, dz Offset of the neighbour from the chunk.
+		 */
+		void gatherNeighbour( Chunk* neighbour, int dx, int dy, int dz );
+
+		/**
+		 * Copies the chunk itself, which must be locked by the caller.
+		 */
+		void gatherChunk( Chunk* chunk );
+
+		/**
+		 * Returns true if the chunk on a face was loaded, faces are FACE_INDEX_*
+		 * values.
+		 */
+		bool hasNeighbour( int face ) const;
+
+		/**
+		 * Returns the block at a position inside the chunk.
+		 */
+		inline BlockPtr getBlock( long x, long y, long z ) const
+		{
+			return mBlocks[ index( x, y, z ) ];
+		}
+
+		/**
+		 * Returns true if the block at a position can't be seen through.
+		 */
+		inline bool isOpaque( long x, long y, long z ) const
+		{
+			return mOpaque[ index( x, y, z ) ] != 0;
+		}
+
+		/**
+		 * Returns the light at a position.
+		 */
+		inline LightIndex getLight( long x, long y, long z ) const
+		{
+			return mLight[ index( x, y, z ) ];
+		}
+	};
+};
+
+#endif
@@ -71,7 +71,16 @@ public:
 	void updatePerspective();
 	Matrix4 getPerspective();
 
+	/**
+	 * Extracts the planes from the camera's view and the perspective.
+	 */
 	void updatePlanes();
+	
+	/**
+	 * Extracts the planes from a combined projection * view matrix, the
+	 * plane normals point into the frustum.
+	 */
+	void setPlanes( const Matrix4& viewProjection );
 
 	void updateFrustumVolume();
 
@@ -86,6 +95,13 @@ public:
 	 */
 	int intersectsAABB( const Vector3& min, const Vector3& max );
 
+	/**
+	 * Tests boxes that all have the given half size, four at a time where
+	 * SSE is available. Centers are given as separate x, y and z arrays,
+	 * visible[i] is set to 0 for boxes entirely outside and 1 otherwise.
+	 */
+	void cullBoxes( const float* x, const float* y, const float* z, size_t count, const Vector3& halfSize, uint8_t* visible );
+
 	/**
 	 * Performs an intersection test against the given points
 	 */
@@ -3,13 +3,24 @@
 #include "prerequisites.h"
 
 class ProgramResource;
+namespace Magnetite {
+	class BufferArena;
+};
 /**
- * @struct Struct to represent a terrain vertex, memory aligned for performance.
+ * @struct Struct to represent a terrain vertex, packed into 8 bytes.
+ * 
+ * Positions are relative to the chunk, which the renderer translates into
+ * place, so they are always whole numbers from 0 to CHUNK_WIDTH.
+ * 
+ * u0 and v0 are the atlas tile rather than texture coordinates, the shader
+ * repeats the tile across the face using the position and face index, so
+ * faces of any size can share one quad.
  */
 struct TerrainVertex {
-	float x, y, z; // 8, 8, 8, 24 bytes
-	GLubyte u0, v0, l; // 1, 1, 1, 27 bytes
-	GLbyte p; // padding, 28 bytes.
+	GLubyte x, y, z; // 1, 1, 1, 3 bytes
+	GLubyte f; // face index, 4 bytes
+	GLubyte u0, v0, l; // 1, 1, 1, 7 bytes
+	GLubyte ao; // ambient occlusion 0 - 3, 8 bytes.
 };
 
 /**
@@ -114,6 +125,18 @@ public:
 	 */
 	TerrainVertex* vertexData;
 	
+	/**
+	 * Arenas holding the uploaded data, NULL if it has its own buffers.
+	 */
+	Magnetite::BufferArena* vertexArena;
+	Magnetite::BufferArena* edgeArena;
+	
+	/**
+	 * Byte offsets of the data within the arenas.
+	 */
+	size_t vertexOffset;
+	size_t edgeOffset;
+	
 	/**
 	 * Constructor
 	 */
@@ -129,8 +152,29 @@ public:
 	 */
 	virtual void bindToBuffer();
 	
+	/**
+	 * Uploads the data into slices of the given arenas, returns false if
+	 * either of them is full.
+	 */
+	bool bindToArena( Magnetite::BufferArena* vertices, Magnetite::BufferArena* edges );
+	
+	/**
+	 * Returns true once the data has been uploaded.
+	 */
+	bool isUploaded();
+	
+	/**
+	 * Releases the geometry's buffers or arena slices.
+	 */
+	virtual void releaseBuffer();
+	
 	virtual void bindVertexAttributes( ProgramResource* program );
 	
+	/**
+	 * Sets up the terrain vertex attributes for the bound vertex buffer.
+	 */
+	static void bindTerrainAttributes( ProgramResource* program );
+	
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef _GREEDYTRIANGULATOR_H_
+#define _GREEDYTRIANGULATOR_H_
+#include "BaseTriangulator.h"
+
+class Chunk;
+
+/**
+ * @class GreedyTriangulator
+ * 
+ * Merges neighbouring faces that point the same way and share a texture,
+ * light level and corner shadows into one quad. Flat terrain becomes a handful of quads instead
+ * of one per block, which also shrinks the physics mesh built from it.
+ * 
+ * It can also merge cubes of blocks into single cells first, to build the
+ * low detail meshes drawn for distant chunks.
+ */
+class GreedyTriangulator : public BaseTriangulator
+{
+protected:
+	/**
+	 * Blocks merged into each cell along every axis.
+	 */
+	int mScale;
+	
+	/**
+	 * Marks the faces of the chunk's visible blocks along with how shadowed
+	 * their corners are.
+	 */
+	void _maskBlocks( Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood, int face, std::vector<uint64_t>& mask );
+	
+	/**
+	 * Marks the faces of solid cells that look into an empty cell, or onto
+	 * any open block on the far side of the chunk's edge.
+	 */
+	void _maskCells( const Magnetite::ChunkNeighbourhood& hood, const std::vector<BlockPtr>& cells, int face, std::vector<uint64_t>& mask );
+	
+public:
+	/**
+	 * @param scale Blocks merged into each cell along every axis. 1 draws
+	 * every block, 2, 4 and 8 build coarser meshes for distant chunks where
+	 * a cell is solid if it holds any block.
+	 */
+	GreedyTriangulator( int scale = 1 );
+	
+	virtual void triangulateChunk( TerrainGeometry* geom, Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood );
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef _JOBPOOL_H_
+#define _JOBPOOL_H_
+#include "prerequisites.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+
+namespace Magnetite
+{
+	typedef std::function<void ()> Job;
+	typedef std::deque<Job> JobQueue;
+	
+	/**
+	 * @class JobPool
+	 * 
+	 * A fixed set of worker threads that run queued jobs in submission order.
+	 * 
+	 * Jobs are responsible for publishing their own results, the pool only
+	 * runs them.
+	 */
+	class JobPool
+	{
+	protected:
+		
+		std::vector<std::thread> mThreads;
+		
+		JobQueue mJobs;
+		
+		std::mutex mMutex;
+		
+		/**
+		 * Signalled when a job is queued or the pool is stopping.
+		 */
+		std::condition_variable mCondition;
+		
+		/**
+		 * Set to false to make the worker threads exit.
+		 */
+		bool mRunning;
+		
+		/**
+		 * Worker thread main loop.
+		 */
+		void _work();
+		
+		/**
+		 * Starts the given number of worker threads.
+		 */
+		void _start( size_t threads );
+		
+		/**
+		 * Stops and joins all of the worker threads, queued jobs are kept.
+		 */
+		void _stop();
+		
+	public:
+		
+		/**
+		 * @param threads Number of worker threads, 0 for one per hardware thread.
+		 */
+		JobPool( size_t threads = 0 );
+		
+		/**
+		 * Waits for running jobs to finish, jobs still queued are discarded.
+		 */
+		~JobPool();
+		
+		/**
+		 * Changes the number of worker threads, waiting for running jobs first.
+		 */
+		void setThreadCount( size_t threads );
+		
+		/**
+		 * Returns the number of worker threads.
+		 */
+		size_t getThreadCount();
+		
+		/**
+		 * Queues a job to be run on one of the worker threads.
+		 */
+		void submit( const Job& job );
+		
+		/**
+		 * Returns the number of jobs waiting for a worker.
+		 */
+		size_t getQueuedCount();
+		
+		/**
+		 * Returns the number of worker threads to use by default.
+		 */
+		static size_t getDefaultThreadCount();
+	};
+};
+
+#endif
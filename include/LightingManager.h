@@ -1,9 +1,18 @@
 #ifndef _LIGHTINGMANAGER_H_
 #define _LIGHTINGMANAGER_H_
 #include "prerequisites.h"
+#include "ChunkNeighbourhood.h"
 
 class Chunk;
+class World;
 
+/**
+ * @class LightingManager
+ *
+ * Spreads light through the open blocks of the world with flood fills.
+ * Sunlight falls straight down from the sky without fading, everywhere
+ * else light loses LightFalloff for each block it travels.
+ */
 class LightingManager
 {
 protected:
@@ -12,18 +21,39 @@ public:
 	LightingManager();
 	~LightingManager();
 
-	enum {
-		POS_X = 1,
-		POS_Z = 2,
-		NEG_X = 4,
-		NEG_Z = 8
-	};
+	/**
+	 * Light of blocks open to the sky.
+	 */
+	static const LightIndex Sunlight = 255;
 
-	static void lightChunk( Chunk* chnk );
-	static void lightColumn( Chunk* chunk, size_t x, size_t z, LightIndex light );
-	static void lightUnderground( Chunk* chunk, size_t x, size_t startY, size_t z, size_t dir, LightIndex light );
+	/**
+	 * Light lost for each block travelled, other than sunlight going down.
+	 */
+	static const LightIndex LightFalloff = 16;
 
-	static void gatherLight( Chunk* chunk );
+	/**
+	 * Lights a whole chunk: sunlight is seeded down each column, light from
+	 * loaded neighbours is taken in at the edges and both are flooded
+	 * through the chunk. Only the chunk's light is written, everything else
+	 * is read from the copy.
+	 * @param hood Copy of the chunk and its neighbours' edges, detached
+	 * chunks have no neighbours
+	 * @return A bit for each face, 1 << FACE_INDEX_*, whose edge layer of
+	 * light changed. The neighbour across it was lit against the old light.
+	 */
+	static int lightChunk( Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood );
+
+	/**
+	 * Updates the light after the block at a world position was placed or
+	 * removed, only visiting the blocks whose light changes. Light crosses
+	 * into any loaded chunk. The light is only written if every chunk it
+	 * reaches can be locked and isn't being meshed.
+	 * @param changed Chunks whose light changed, or whose faces are lit by
+	 * a changed block across their edge, are added to this
+	 * @return false if a chunk was busy, nothing is changed then and the
+	 * update should be tried again later.
+	 */
+	static bool updateBlock( World* world, long x, long y, long z, std::vector<Chunk*>& changed );
 };
 
 #endif
@@ -37,6 +37,16 @@ protected:
 	World*		mWorld;
 	bool		mContinue;
 	float		mTimescale;
+	
+	/**
+	 * Number of chunk worker threads, 0 for the default.
+	 */
+	size_t		mWorkerCount;
+	
+	/**
+	 * Use the GreedyTriangulator for world geometry.
+	 */
+	bool		mGreedyMeshing;
 
 	/**
 	 * Physics
@@ -0,0 +1,62 @@
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+#include "prerequisites.h"
+
+namespace Magnetite
+{
+	/**
+	 * @class MappedFile
+	 * 
+	 * A read only view of a whole file.
+	 * 
+	 * The file is memory mapped where the platform supports it, so reads come
+	 * straight from the page cache without copying. Elsewhere the file is
+	 * read into memory when it is opened.
+	 * 
+	 * The view doesn't follow the file if it grows, re-open it to see the new
+	 * data. The file must not be truncated while it is open.
+	 */
+	class MappedFile
+	{
+	protected:
+		
+		const char* mData;
+		
+		size_t mSize;
+		
+#ifdef WIN32
+		std::vector<char> mBuffer;
+#endif
+		
+	public:
+		
+		MappedFile();
+		
+		~MappedFile();
+		
+		MappedFile( const MappedFile& ) = delete;
+		MappedFile& operator=( const MappedFile& ) = delete;
+		
+		/**
+		 * Opens the file at path, closing any file already open.
+		 * @return false if the file doesn't exist or is empty.
+		 */
+		bool open( const String& path );
+		
+		void close();
+		
+		bool isOpen() const;
+		
+		/**
+		 * Returns the contents of the file.
+		 */
+		const char* getData() const;
+		
+		/**
+		 * Returns the size of the file when it was opened.
+		 */
+		size_t getSize() const;
+	};
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _OCCLUSIONCULLER_H_
+#define _OCCLUSIONCULLER_H_
+#include "prerequisites.h"
+#include <unordered_map>
+
+class Geometry;
+
+namespace Magnetite
+{
+	/**
+	 * @class OcclusionCuller
+	 *
+	 * Skips geometry hidden behind what was drawn in earlier frames, using
+	 * occlusion queries on bounding boxes.
+	 *
+	 * Query results are only read once the GPU reports them available, so
+	 * the CPU never waits on them. Hidden geometry is tested every frame
+	 * and shows up a frame after it becomes visible, visible geometry is
+	 * only re-tested every few frames.
+	 *
+	 * All methods must be called on the render thread.
+	 */
+	class OcclusionCuller
+	{
+	protected:
+		
+		struct GeometryQuery
+		{
+			GLuint query;
+			bool pending;
+			bool occluded;
+			size_t lastTest;
+		};
+		
+		typedef std::unordered_map<const Geometry*, GeometryQuery> QueryMap;
+		
+		QueryMap mQueries;
+		
+		/**
+		 * Boxes to draw in the next call to runQueries.
+		 */
+		struct QueuedTest
+		{
+			GLuint query;
+			Vector3 min;
+			Vector3 max;
+		};
+		std::vector<QueuedTest> mTests;
+		
+		/**
+		 * GL_ANY_SAMPLES_PASSED where supported, GL_SAMPLES_PASSED otherwise.
+		 */
+		GLenum mQueryTarget;
+		
+		size_t mFrame;
+	
+	public:
+		
+		/**
+		 * Frames between re-testing geometry that was visible.
+		 */
+		static const size_t VisibleRetestInterval = 8;
+		
+		OcclusionCuller();
+		
+		~OcclusionCuller();
+		
+		/**
+		 * Returns false if the geometry was hidden when it was last tested,
+		 * and queues another test when one is due.
+		 * @param geom Geometry being drawn
+		 * @param min Minimum corner of its bounds in world space
+		 * @param max Maximum corner of its bounds in world space
+		 * @param eye Camera position
+		 */
+		bool isVisible( const Geometry* geom, const Vector3& min, const Vector3& max, const Vector3& eye );
+		
+		/**
+		 * Draws the queued test boxes without writing color or depth, call
+		 * once the frame's opaque geometry is drawn with the view loaded.
+		 */
+		void runQueries();
+		
+		/**
+		 * Forgets geometry that is being deleted.
+		 */
+		void release( const Geometry* geom );
+	};
+};
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef _REGIONFILE_H_
+#define _REGIONFILE_H_
+#include "prerequisites.h"
+#include "MappedFile.h"
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+namespace Magnetite
+{
+	/**
+	 * @class RegionFile
+	 *
+	 * Packs the chunks of a single Region into one file.
+	 *
+	 * The file starts with a header holding the offset and length of every
+	 * chunk in the region, chunk data follows in whole sectors. A chunk that
+	 * still fits its sectors is rewritten in place, otherwise it moves to the
+	 * first free run large enough or the end of the file. Space freed that
+	 * way is reclaimed by compact().
+	 * 
+	 * Chunks are read through a MappedFile, so they can be decoded straight
+	 * from the page cache.
+	 *
+	 * All methods are safe to call from multiple threads.
+	 */
+	typedef std::function<bool ( const char* data, size_t length )> ChunkReader;
+	
+	class RegionFile
+	{
+	public:
+
+		/**
+		 * Size of an allocation unit in the file.
+		 */
+		static const size_t SectorSize = 4096;
+
+		/**
+		 * Number of chunks in a region file.
+		 */
+		static const size_t ChunkCount = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+
+		/**
+		 * Version written to new files.
+		 */
+		static const uint32_t Version = 1;
+
+	protected:
+
+		struct Entry
+		{
+			/**
+			 * First sector of the chunk's data, 0 if the chunk isn't stored.
+			 */
+			uint32_t sector;
+
+			/**
+			 * Length of the chunk's data in bytes.
+			 */
+			uint32_t length;
+		};
+
+		struct Header
+		{
+			char magic[4];
+			uint32_t version;
+			Entry entries[ChunkCount];
+		};
+
+		/**
+		 * Number of sectors taken by the header.
+		 */
+		static const size_t HeaderSectors = ( sizeof( Header ) + SectorSize - 1 ) / SectorSize;
+
+		String mPath;
+
+		std::fstream mFile;
+		
+		/**
+		 * Read view of the file, replaced when it no longer covers a chunk.
+		 * Readers keep their own reference, so an old view stays open
+		 * until the last of them is done with it.
+		 */
+		std::shared_ptr<MappedFile> mMap;
+		
+		/**
+		 * Number of readChunk calls reading from a view, compacting moves
+		 * and truncates chunk data so it waits for them.
+		 */
+		size_t mReaders;
+		
+		/**
+		 * Signalled when a reader is done.
+		 */
+		std::condition_variable mReadersDone;
+
+		Header mHeader;
+
+		/**
+		 * Which sectors are in use, the header's sectors are always used.
+		 */
+		std::vector<bool> mUsedSectors;
+
+		std::mutex mMutex;
+
+		/**
+		 * Returns the number of sectors needed for the given number of bytes.
+		 */
+		static size_t _sectorsFor( size_t bytes );
+
+		/**
+		 * Finds (or appends) a run of free sectors and marks it used.
+		 */
+		uint32_t _allocate( size_t sectors );
+
+		/**
+		 * Marks a run of sectors as free, trimming the sector map if they were at the end.
+		 */
+		void _release( uint32_t sector, size_t sectors );
+
+		/**
+		 * Writes the header entry for a chunk back to the file.
+		 */
+		void _writeEntry( size_t index );
+
+		/**
+		 * Returns the number of unused sectors, mMutex must be held.
+		 */
+		size_t _getWastedSectors();
+
+		/**
+		 * Moves all chunks to the front of the file and truncates it, mMutex must be held
+		 * and nothing may be reading.
+		 */
+		void _compact();
+
+	public:
+
+		RegionFile();
+
+		~RegionFile();
+
+		/**
+		 * Opens the region file at path.
+		 * @param create Create an empty region file if none exists.
+		 * @return true if the file is open.
+		 */
+		bool open( const String& path, bool create );
+
+		/**
+		 * Returns true if the given chunk is stored in the file.
+		 * @param index Index of the chunk inside the region.
+		 */
+		bool hasChunk( size_t index );
+
+		/**
+		 * Passes a chunk's data to reader without copying it. The file
+		 * isn't locked while reader runs, so other chunks can be read and
+		 * written meanwhile, but reader shouldn't hold on to the data.
+		 * @return false if the chunk isn't stored, or what reader returns.
+		 */
+		bool readChunk( size_t index, const ChunkReader& reader );
+		
+		/**
+		 * Copies the data for a chunk.
+		 * @return false if the chunk isn't stored.
+		 */
+		bool readChunk( size_t index, std::vector<char>& data );
+
+		/**
+		 * Stores the data for a chunk, replacing any existing data.
+		 */
+		bool writeChunk( size_t index, const char* data, size_t length );
+
+		/**
+		 * Removes a chunk from the file.
+		 */
+		void removeChunk( size_t index );
+
+		/**
+		 * Returns the number of unused sectors between chunks.
+		 */
+		size_t getWastedSectors();
+
+		/**
+		 * Moves all chunks to the front of the file and truncates it, once
+		 * no chunks are being read.
+		 */
+		void compact();
+
+		/**
+		 * Returns the index of a chunk inside its region, from its world chunk index.
+		 */
+		static size_t chunkIndex( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+	};
+};
+
+#endif
@@ -9,6 +9,10 @@ class BaseBlock;
 class Camera;
 class World;
 class ProgramResource;
+namespace Magnetite {
+	class BufferArena;
+	class OcclusionCuller;
+};
 
 /**
  * Geometry types, used to dermine wether the renderer should use Geometry shaders or push the finished vertex data to the GPU
@@ -19,6 +23,17 @@ enum GeomType {
 	GEOM_GEOMSHADER = 2
 };
 
+/**
+ * Layout of a glMultiDrawElementsIndirect command.
+ */
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLuint baseVertex;
+	GLuint baseInstance;
+};
+
 /**
  * Debug typedefs
  */
@@ -60,6 +75,138 @@ protected:
 	 * Stores a list of debuging points
 	 */
 	LineList mDebugLines;
+	
+	/**
+	 * Geometry replaced by other threads, deleted at the start of the next frame.
+	 */
+	std::vector<Geometry*> mRetiredGeometry;
+	
+	/**
+	 * Protects mRetiredGeometry.
+	 */
+	std::mutex mRetiredMutex;
+	
+	/**
+	 * Deletes retired geometry, must be called on the render thread.
+	 */
+	void _deleteRetired();
+	
+	/**
+	 * Shared buffers for chunk vertices and edges, NULL if the GL can't
+	 * draw from an offset into them.
+	 */
+	Magnetite::BufferArena* mTerrainVertices;
+	Magnetite::BufferArena* mTerrainEdges;
+	
+	/**
+	 * Sizes of the terrain arenas in bytes.
+	 */
+	static const size_t TerrainVertexArenaSize = 64 * 1024 * 1024;
+	static const size_t TerrainEdgeArenaSize = 32 * 1024 * 1024;
+	
+	/**
+	 * True if chunks in the arenas are drawn with one glMultiDrawElementsIndirect.
+	 */
+	bool mMultiDraw;
+	
+	/**
+	 * Buffers for the indirect draw commands and the chunk origin of each one.
+	 */
+	GLuint mIndirectBO;
+	GLuint mChunkOffsetBO;
+	
+	/**
+	 * Draw commands and chunk origins gathered each frame, kept to avoid
+	 * reallocating them.
+	 */
+	std::vector<DrawElementsIndirectCommand> mDrawCommands;
+	std::vector<GLfloat> mDrawOffsets;
+	
+	/**
+	 * Indices into mVisibleChunks of chunks drawn one at a time as they
+	 * aren't in the arenas.
+	 */
+	std::vector<size_t> mUnbatchedChunks;
+	
+	/**
+	 * Chunks inside the view frustum this frame.
+	 */
+	std::vector<Chunk*> mVisibleChunks;
+	
+	/**
+	 * Geometry drawn for each of mVisibleChunks, at the level of detail
+	 * chosen for it this frame.
+	 */
+	std::vector<TerrainGeometry*> mVisibleGeometry;
+	
+	/**
+	 * Distance from the camera beyond which chunks are drawn at each level
+	 * of detail after the first.
+	 */
+	float mLodDistances[CHUNK_LOD_LEVELS - 1];
+	
+	/**
+	 * Number of chunks drawn below full detail this frame.
+	 */
+	size_t mLodChunks;
+	
+	/**
+	 * Returns the chunk's geometry at the level of detail for its distance
+	 * from the eye, or the closest finer level that has been built.
+	 */
+	TerrainGeometry* _chooseGeometry( Chunk* chunk, const Vector3& eye );
+	
+	/**
+	 * Number of loaded chunks outside the view frustum this frame.
+	 */
+	size_t mCulledChunks;
+	
+	/**
+	 * Number of loaded chunks enclosed where the camera can't see them.
+	 */
+	size_t mEnclosedChunks;
+	
+	/**
+	 * Chunks in regions crossing the edge of the frustum, with their centers
+	 * split into x, y and z for Frustum::cullBoxes.
+	 */
+	std::vector<Chunk*> mCullChunks;
+	std::vector<float> mCullX;
+	std::vector<float> mCullY;
+	std::vector<float> mCullZ;
+	std::vector<uint8_t> mCullResults;
+	
+	/**
+	 * Fills mVisibleChunks with the chunks the camera can see, testing whole
+	 * regions first.
+	 */
+	void _cullChunks( World* world );
+	
+	/**
+	 * Skips chunks hidden behind earlier frames, NULL if disabled.
+	 */
+	Magnetite::OcclusionCuller* mOcclusion;
+	
+	/**
+	 * Number of chunks in the frustum skipped as hidden this frame.
+	 */
+	size_t mOccludedChunks;
+	
+	/**
+	 * Removes hidden chunks and chunks with nothing to draw from mVisibleChunks,
+	 * and fills mVisibleGeometry for the rest.
+	 */
+	void _occludeChunks();
+	
+	/**
+	 * Uploads the geometry if it hasn't been, returns false if it couldn't be.
+	 */
+	bool _uploadGeometry( TerrainGeometry* geom );
+	
+	/**
+	 * Draws all of the visible chunks with a single indirect draw call.
+	 */
+	void _renderChunksBatched();
 
 public:
 	Renderer(void);
@@ -127,7 +274,13 @@ public:
 
 	void render( double dt, World* world );
 
-	void _renderChunk( Magnetite::ChunkRegionPtr region, Chunk* chunk );
+	void _renderChunk( Chunk* chunk, TerrainGeometry* geom );
+	
+	/**
+	 * Queues geometry to be deleted on the render thread once it can no
+	 * longer be drawn. Safe to call from any thread.
+	 */
+	void retireGeometry( Geometry* geometry );
 
 	/**
 	 * Draws debug statistics onto the screen
@@ -180,6 +333,21 @@ public:
 	 */
 	GeomType getGeometryType();
 
+	/**
+	 * Enables or disables skipping chunks hidden behind others.
+	 */
+	void setOcclusionCulling( bool enabled );
+	bool isOcclusionCulling();
+	
+	/**
+	 * Sets the distance from the camera beyond which chunks are drawn at a
+	 * level of detail, each merging twice as many blocks as the last.
+	 * @param level Level of detail, from 1 to CHUNK_LOD_LEVELS - 1
+	 * @param distance Distance in blocks
+	 */
+	void setLodDistance( size_t level, float distance );
+	float getLodDistance( size_t level );
+	
 	/**
 	 * Sets the Debug mode
 	 */
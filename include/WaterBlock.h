@@ -3,11 +3,11 @@
 #include "prerequisites.h"
 #include "BaseBlock.h"
 
+/**
+ * Water, the fluid level of each voxel is stored in its Chunk.
+ */
 class WaterBlock : public BaseBlock
 {
-protected:
-	float mFluidLevel;
-	bool mIsNew;
 public:
 	WaterBlock();
 	~WaterBlock(void);
@@ -19,17 +19,17 @@ public:
 
 	std::string getType();
 
-	float getFluidLevel();
-	void changeFluidLevel( float delta );
-	void setFluidLevel( float delta );
+	float getFluidLevel( BlockContext& ctx );
+	void changeFluidLevel( BlockContext& ctx, float delta );
+	void setFluidLevel( BlockContext& ctx, float level );
 
 	void getTextureCoords( short face, short &x, short &y );
 
 	void connectedChange( short face );
 
-	void flow( float dt );
+	void flow( BlockContext& ctx, float dt );
 
-	void balanceFluid( BaseBlock* block, float dt);
+	void balanceFluid( BlockContext& ctx, BlockContext& other, float dt );
 	void flowToBlock(unsigned short x, unsigned short y, unsigned short z, float dt);
 
 	/**
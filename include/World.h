@@ -4,13 +4,15 @@
 #include <deque>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <memory>
 #include <glm/core/type.hpp>
 #include "Region.h"
 #include "MovingBlock.h"
 #include "paging/PagingContext.h"
 
 namespace Magnetite {
-class WorldSerializer;class BaseEntity;
+class WorldSerializer;class BaseEntity;class JobPool;class ChunkNeighbourhood;
 }
 
 class BaseTriangulator;
@@ -138,9 +140,47 @@ struct ChunkRequest
 {
 	ChunkScalar x, y, z;
 	bool unload;
+	
+	/**
+	 * Order the request is served in, lower first. Updated every tick.
+	 */
+	float priority;
+};
+
+/**
+ * Pending chunk requests, keyed by page index so there is at most one
+ * request for any page.
+ */
+typedef std::map<size_t, ChunkRequest> ChunkLoadList;
+
+/**
+ * @struct ChunkJob
+ * 
+ * A chunk being loaded or generated on the job pool. The chunk isn't in the
+ * world until the world thread publishes it, so workers can fill it without
+ * locking.
+ */
+struct ChunkJob
+{
+	ChunkScalar x, y, z;
+	
+	/**
+	 * The finished chunk, owned by the job until it is published.
+	 */
+	Chunk* chunk;
+	
+	/**
+	 * Set by the world thread if the page was unloaded while in flight.
+	 */
+	std::atomic<bool> cancelled;
+	
+	ChunkJob( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+	~ChunkJob();
 };
 
-typedef std::deque<ChunkRequest> ChunkLoadList;
+typedef std::shared_ptr<ChunkJob> ChunkJobPtr;
+typedef std::map<size_t, ChunkJobPtr> ChunkJobMap;
+typedef std::deque<ChunkJobPtr> ChunkJobList;
 /**
  * ChunkArray - an array of Chunks
  */
@@ -170,9 +210,10 @@ protected:
 	Magnetite::EntityList mEntities;
 	
 	/**
-	 * The Triangulator to use for creating the world geometry
+	 * The Triangulator to use for creating the world geometry, shared with
+	 * the mesh jobs so replacing it doesn't pull it out from under them.
 	 */
-	BaseTriangulator* mTriangulator;
+	std::shared_ptr<BaseTriangulator> mTriangulator;
 	
 	/**
 	 * Serializer, for writing chunks to disk
@@ -184,6 +225,144 @@ protected:
 	 */
 	std::mutex mWorldMutex;
 	
+	/**
+	 * Worker threads for loading, generating and lighting chunks.
+	 */
+	Magnetite::JobPool* mJobPool;
+	
+	/**
+	 * Maximum number of in flight chunk jobs per worker thread, requests
+	 * beyond that wait in mChunkRequests where they can still be reordered.
+	 */
+	static const size_t MaxJobsPerWorker = 2;
+	
+	/**
+	 * Maximum number of chunks unloaded per update.
+	 */
+	static const size_t MaxUnloadsPerUpdate = 8;
+	
+	/**
+	 * Seconds between checkpoints, 0 to disable them.
+	 */
+	float mCheckpointInterval;
+	
+	/**
+	 * Seconds since the last checkpoint.
+	 */
+	float mCheckpointTimer;
+	
+	/**
+	 * Maximum number of chunks saved per update while a checkpoint runs.
+	 */
+	static const size_t MaxSavesPerUpdate = 8;
+	
+	/**
+	 * True while a checkpoint is being spread across updates.
+	 */
+	bool mCheckpointing;
+	
+	/**
+	 * The next chunk slot the running checkpoint looks at, counted across
+	 * every region in order.
+	 */
+	size_t mCheckpointCursor;
+	
+	/**
+	 * Number of chunks the running checkpoint has saved so far.
+	 */
+	size_t mCheckpointSaved;
+	
+	/**
+	 * Chunk jobs that are in flight, keyed by page index.
+	 * Only touched by the world thread.
+	 */
+	ChunkJobMap mChunkJobs;
+	
+	/**
+	 * Chunk jobs that have finished and are waiting to be published.
+	 */
+	ChunkJobList mCompletedJobs;
+	
+	/**
+	 * Protects mCompletedJobs.
+	 */
+	std::mutex mCompletedMutex;
+	
+	/**
+	 * A block placed or removed through setBlockAt or removeBlockAt.
+	 */
+	struct BlockChange
+	{
+		long x, y, z;
+	};
+	
+	/**
+	 * Block edits waiting for the light around them to be updated.
+	 */
+	std::vector<BlockChange> mBlockChanges;
+	
+	/**
+	 * Protects mBlockChanges, blocks can be edited from any thread.
+	 */
+	std::mutex mBlockChangeMutex;
+	
+	/**
+	 * Relights around each recorded block edit, then flags the chunks whose
+	 * light changed or whose faces meet the edited block to be remeshed.
+	 * Runs on the world thread.
+	 */
+	void _applyBlockChanges();
+	
+	/**
+	 * Counts visibility passes, chunks reached by the latest ones are drawn.
+	 * 0 until the first pass, or when there is no camera to start from.
+	 */
+	std::atomic<uint32_t> mVisibilityStamp;
+	
+	/**
+	 * Set when chunks are loaded, unloaded or change connectivity.
+	 */
+	bool mVisibilityDirty;
+	
+	/**
+	 * Chunk the last visibility pass started from.
+	 */
+	ChunkScalar mVisibilityX, mVisibilityY, mVisibilityZ;
+	
+	/**
+	 * One bit per chunk in the world, set for chunks the visibility pass
+	 * has reached. Kept between passes to avoid reallocating it.
+	 */
+	std::vector<bool> mVisibilityVisited;
+	
+	/**
+	 * Flood fills the chunks from the camera's chunk through connected faces,
+	 * stamping each chunk that could be seen. The fill stops at chunks that
+	 * aren't loaded, so it never leaves the paged area. Runs on the world thread.
+	 */
+	void _updateVisibility();
+	
+	/**
+	 * Returns the key for a chunk in mChunkJobs.
+	 */
+	size_t _chunkJobKey( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+	
+	/**
+	 * Loads or generates the job's chunk, runs on a worker thread.
+	 */
+	void _runChunkJob( const ChunkJobPtr& job );
+	
+	/**
+	 * Inserts finished chunks into the world, runs on the world thread.
+	 */
+	void _publishChunks();
+	
+	/**
+	 * Saves the next few modified chunks of the running checkpoint. Stops
+	 * early if the write buffer is full, to carry on next update.
+	 */
+	void _continueCheckpoint();
+	
 	/**
 	 * Internal function to add entities to the mEntities list.
 	 */
@@ -215,6 +394,44 @@ public:
 	 * Returns the triangulator to use for generating meshes.
 	 */
 	BaseTriangulator* getTriangulator();
+	
+	/**
+	 * Replaces the triangulator used for world geometry, the world takes
+	 * ownership of it. Loaded chunks are remeshed with it.
+	 */
+	void setTriangulator( BaseTriangulator* triangulator );
+	
+	/**
+	 * Returns true unless the chunk is enclosed where the camera can't see it.
+	 * Safe to call from the render thread.
+	 */
+	bool isPotentiallyVisible( Chunk* chunk );
+	
+	/**
+	 * Returns true if the chunk's mesh should be built now, meshes for
+	 * enclosed chunks wait until they can be seen, unless they are next to
+	 * the camera where their physics is needed.
+	 */
+	bool isMeshWanted( Chunk* chunk );
+	
+	/**
+	 * Returns true if the chunk is far enough from the camera that it may
+	 * be drawn below full detail soon, so its lower detail meshes are built.
+	 */
+	bool isLodWanted( Chunk* chunk );
+	
+	/**
+	 * Requests a new visibility pass, call when a chunk's connectivity changes.
+	 */
+	void _invalidateVisibility();
+	
+	/**
+	 * Queues a job to build the chunk's mesh on a worker thread. The chunk
+	 * can't be unloaded until Chunk::isMeshing returns false.
+	 * @param hood The chunk's neighbourhood with its border already gathered.
+	 * @param lods Build the lower detail meshes as well.
+	 */
+	void requestMesh( Chunk* chunk, const std::shared_ptr<Magnetite::ChunkNeighbourhood>& hood, bool lods );
 
 	/**
 	 * Returns the color of a brightness level
@@ -307,22 +524,55 @@ public:
 	bool printDbg;
 
 	/**
-	 * Requests that the engine load or generate the chunk at the given index
+	 * Requests that the engine load or generate the chunk at the given index.
+	 * Cancels any pending unload request for the chunk instead.
 	 */
 	void requestChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z );
 	
 	/**
 	 * Requests that the engine unload the given chunk.
+	 * Cancels any pending load request for the chunk instead.
 	 */
 	void requestChunkUnload( ChunkScalar x, ChunkScalar y, ChunkScalar z );
 	
 	/**
-	 * Returns the number of queued chunk requests.
+	 * Returns the number of queued or in flight chunk requests.
 	 */
 	size_t getNumChunkRequests() {
-		return mChunkRequests.size();
+		return mChunkRequests.size() + mChunkJobs.size();
 	}
 	
+	/**
+	 * Sets the number of worker threads used for loading and generating chunks.
+	 * @param workers Number of workers, 0 for one per hardware thread.
+	 */
+	void setWorkerCount( size_t workers );
+	
+	/**
+	 * Returns the number of worker threads used for loading and generating chunks.
+	 */
+	size_t getWorkerCount();
+	
+	/**
+	 * Saves every loaded chunk that has been modified since it was last
+	 * saved. Chunks are only snapshotted, the writes happen in the background,
+	 * but this waits whenever the write buffer is full.
+	 */
+	void checkpoint();
+	
+	/**
+	 * Sets how often update() starts a checkpoint. These are spread across
+	 * updates and pause while the write buffer is full, rather than
+	 * waiting like checkpoint().
+	 * @param seconds Interval in seconds, 0 to disable checkpoints.
+	 */
+	void setCheckpointInterval( float seconds );
+	
+	/**
+	 * Returns the interval between checkpoints in seconds.
+	 */
+	float getCheckpointInterval();
+	
 	/**
 	 * Creates a chunk at the given coordinates.
 	 * @param x Coordinate
@@ -369,14 +619,16 @@ public:
 	void createTestChunks( int size );
 
 	/**
-	 * Activates a chunk, loading it if it is stored on disk, or generating it if necassery
+	 * Activates a chunk, loading it if it is stored on disk, or generating it if necassery.
+	 * The work is done on the job pool, the chunk appears in the world on a later update.
 	 */
 	void activateChunk( long x, long y, long z );
 
 	/**
-	 * Deactivates a chunk
+	 * Deactivates a chunk, saving it first if it was modified.
+	 * @return false if the chunk couldn't be saved yet and is still loaded.
 	 */
-	void deactivateChunk( long x, long y, long z );
+	bool deactivateChunk( long x, long y, long z );
 	
 	/**
 	 * Causes all adjacent chunks to update
@@ -419,9 +671,14 @@ public:
 	Chunk* getChunk(const long x, const long y, const long z);
 	
 	/**
-	 * Returns the Region at the given indexes 
+	 * Returns the Region at the given indexes, creating it if it is inside the world.
 	 */
 	Magnetite::ChunkRegionPtr getRegion(const ChunkScalar x, const ChunkScalar y, const ChunkScalar z);
+	
+	/**
+	 * Returns the Region at the given indexes, or null if it hasn't been created.
+	 */
+	Magnetite::ChunkRegionPtr findRegion(const ChunkScalar x, const ChunkScalar y, const ChunkScalar z);
 
 	/**
 	 * Creates a new sky object 
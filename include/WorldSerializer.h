@@ -2,14 +2,40 @@
 #define _WORLDSERIALIZER_H_
 #include "prerequisites.h"
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <tuple>
 
 class World;
+class Chunk;
 namespace Magnetite 
 {
+	class RegionFile;
+	typedef std::map<String, RegionFile*> RegionFileMap;
+	typedef std::tuple<ChunkScalar, ChunkScalar, ChunkScalar> ChunkKey;
+	
+	/**
+	 * Encoded chunk data, shared between the world and I/O threads.
+	 */
+	typedef std::shared_ptr<std::vector<char>> ChunkSnapshot;
+	typedef std::map<ChunkKey, ChunkSnapshot> ChunkSnapshotMap;
+	
 	/**
 	 * @class WorldSerializer
 	 * 
 	 * Handles saving and loading worlds (or portions therof) to binary streams.
+	 * 
+	 * Chunks are stored in one RegionFile per Region, chunks saved by older
+	 * versions in their own files are still read.
+	 * 
+	 * Disk access happens on a dedicated I/O thread. Saving a chunk only
+	 * encodes a snapshot of it, which waits in a bounded write-behind buffer
+	 * until the I/O thread writes it out; loads check that buffer first so
+	 * they always see the latest data. Chunks can also be read ahead of
+	 * time, so the load itself doesn't have to wait for the disk.
 	 */
 	class WorldSerializer
 	{
@@ -19,10 +45,126 @@ namespace Magnetite
 		
 		Magnetite::String mWorldPath;
 		
+		/**
+		 * Open region files, keyed by path.
+		 */
+		RegionFileMap mRegionFiles;
+		
+		/**
+		 * Protects mRegionFiles.
+		 */
+		std::mutex mRegionMutex;
+		
+		/**
+		 * Returns the region file holding the given chunk.
+		 * @param create Create the file if it doesn't exist.
+		 * @return the region file, or null if it doesn't exist.
+		 */
+		RegionFile* _getRegionFile( ChunkScalar x, ChunkScalar y, ChunkScalar z, bool create );
+		
+		/**
+		 * Maximum number of snapshots waiting to be written, saving waits or
+		 * gives up while the buffer is full.
+		 */
+		static const size_t MaxPendingWrites = 64;
+		
+		/**
+		 * Maximum number of chunks kept from read ahead.
+		 */
+		static const size_t MaxReadAhead = 64;
+		
+		/**
+		 * Snapshots waiting to be written, and the order they were saved in.
+		 * A snapshot stays here until it is on disk.
+		 */
+		ChunkSnapshotMap mPendingWrites;
+		std::deque<ChunkKey> mWriteQueue;
+		
+		/**
+		 * A chunk read ahead of a load, with its place in mReadAheadOrder.
+		 */
+		struct ReadAheadEntry
+		{
+			ChunkSnapshot snapshot;
+			std::list<ChunkKey>::iterator order;
+		};
+		typedef std::map<ChunkKey, ReadAheadEntry> ReadAheadMap;
+		
+		/**
+		 * Chunks read ahead of a load, and the order they were read in.
+		 */
+		ReadAheadMap mReadAhead;
+		std::list<ChunkKey> mReadAheadOrder;
+		
+		/**
+		 * Forgets a chunk that was read ahead, mIOMutex must be held.
+		 */
+		void _dropReadAhead( ReadAheadMap::iterator it );
+		
+		/**
+		 * Chunks waiting to be read ahead.
+		 */
+		std::deque<ChunkKey> mPrefetchQueue;
+		
+		/**
+		 * Protects the write, read ahead and prefetch lists.
+		 */
+		std::mutex mIOMutex;
+		
+		/**
+		 * Signalled when there is work for the I/O thread, or it should stop.
+		 */
+		std::condition_variable mIOCondition;
+		
+		/**
+		 * Signalled when the I/O thread has written something.
+		 */
+		std::condition_variable mWrittenCondition;
+		
+		std::thread mIOThread;
+		
+		/**
+		 * Set to false to make the I/O thread exit once everything is written.
+		 */
+		bool mRunning;
+		
+		/**
+		 * I/O thread main loop.
+		 */
+		void _ioWork();
+		
+		/**
+		 * Reads a chunk's encoded data from disk.
+		 */
+		bool _readChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z, std::vector<char>& data );
+		
+		/**
+		 * Decodes encoded chunk data into a chunk. The data is checked
+		 * first, so the chunk is left untouched if it is invalid.
+		 */
+		bool _decodeChunk( Chunk* chunk, const char* data, size_t length );
+		
+		/**
+		 * Writes a snapshot to disk.
+		 */
+		void _writeChunk( const ChunkKey& key, const ChunkSnapshot& snapshot );
+		
 	public:
 		
+		/**
+		 * Outcome of loading a chunk.
+		 */
+		enum LoadResult {
+			NotStored, // Nothing is saved for the chunk.
+			Loaded,
+			Corrupt // The saved data couldn't be decoded, the chunk is left untouched.
+		};
+		
 		WorldSerializer( World* mWorld );
 		
+		/**
+		 * Writes any pending snapshots and stops the I/O thread.
+		 */
 		~WorldSerializer();
 		
 		/** 
@@ -30,6 +172,12 @@ namespace Magnetite
 		 */
 		String resolveRegion( ChunkScalar x, ChunkScalar y, ChunkScalar z );
 		
+		/**
+		 * Figures out the path of the single-chunk file older versions saved
+		 * the given chunk to.
+		 */
+		String resolveChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+		
 		/**
 		 * Check to see if the serializer has the given chunk.
 		 */
@@ -42,9 +190,36 @@ namespace Magnetite
 		bool loadChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z );
 		
 		/**
-		 * Requests that the serializer writes the given chunk into the stream.
+		 * Loads the stored data for a chunk into it, the chunk doesn't need to
+		 * be in the world so this is safe to call from worker threads. The
+		 * chunk is only changed if this returns Loaded.
+		 */
+		LoadResult loadChunk( Chunk* chunk );
+		
+		/**
+		 * Takes a snapshot of the given chunk to be written by the I/O thread,
+		 * whether or not it has been modified. The chunk can be removed from
+		 * the world as soon as this returns true.
+		 * @param wait Wait for room if the write buffer is full, otherwise
+		 * return false without saving the chunk.
+		 * @return true if the chunk was saved.
+		 */
+		bool saveChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z, bool wait = true );
+		
+		/**
+		 * Asks the I/O thread to read a chunk ahead of it being loaded.
+		 */
+		void prefetchChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+		
+		/**
+		 * Blocks until every pending snapshot has been written.
+		 */
+		void flush();
+		
+		/**
+		 * Returns the number of snapshots waiting to be written.
 		 */
-		void saveChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+		size_t getPendingWriteCount();
 		
 	};
 };
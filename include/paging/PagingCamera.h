@@ -25,6 +25,16 @@ class PagingContext;
 		 */
 		float mFar;
 		
+		/**
+		 * Normalised view direction.
+		 */
+		Vector3 mDirection;
+		
+		/**
+		 * Half-angle of the view cone in radians, pi sees everything.
+		 */
+		float mViewAngle;
+		
 		/**
 		 * Paging Context in which the camera exists.
 		 */
@@ -44,6 +54,22 @@ class PagingContext;
 		
 		float getViewDistance();
 		
+		void setDirection( const Vector3& dir );
+		
+		Vector3 getDirection();
+		
+		/**
+		 * Sets the half-angle of the cone the camera can see, in radians.
+		 */
+		void setViewAngle( float angle );
+		
+		float getViewAngle();
+		
+		/**
+		 * Returns true if any part of the sphere is inside the view cone.
+		 */
+		bool isInView( const Vector3& center, float radius );
+		
 		/**
 		 * Tells the PC to update what it sees.
 		 */
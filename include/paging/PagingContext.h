@@ -108,6 +108,14 @@ namespace Magnetite
 		 */
 		void update();
 		
+		/**
+		 * Returns how urgently the page is needed, lower is more urgent.
+		 * 
+		 * This is the distance to the nearest camera, pages outside of a
+		 * camera's view count as being further away.
+		 */
+		float getPagePriority( ChunkScalar x, ChunkScalar y, ChunkScalar z );
+		
 		/**
 		 * Used internally, notfies the PagingContext that a camera can see the page.
 		 */
@@ -82,6 +82,11 @@ class Chunk;
 #define REGION_SIZE 8
 #define REGION_WORLD_SIZE (REGION_SIZE * CHUNK_WIDTH)
 
+/**
+ * Meshes built for each chunk, level n merges 2^n blocks along each axis.
+ */
+#define CHUNK_LOD_LEVELS 4
+
 //#define BLOCK_POSITION( index ) index % CHUNK_WIDTH * CHUNK_HEIGHT , (index - std::floorf( index / CHUNK_WIDTH*CHUNK_HEIGHT ) - (index % CHUNK_WIDTH))   , std::floorf( index / CHUNK_WIDTH*CHUNK_HEIGHT ) 
 #define BLOCK_INDEX_2( x, y, z ) ( z * CHUNK_WIDTH * CHUNK_HEIGHT + y * CHUNK_WIDTH + x )
 #define BLOCK_INDEX( block ) (block->getZ() * CHUNK_WIDTH * CHUNK_HEIGHT + block->getY() * CHUNK_WIDTH + block->getX())
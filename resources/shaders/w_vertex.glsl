@@ -1,16 +1,32 @@
 #version 120 
 uniform sampler2D worldDiffuse;
 
-attribute vec3 in_params;
-attribute vec3 in_vertex;
+// Chunk relative position and face index.
+attribute vec4 in_vertex;
+// Atlas tile, light and ambient occlusion.
+attribute vec4 in_params;
+// Chunk origin when drawing many chunks at once, zero otherwise.
+attribute vec3 in_offset;
 
 varying float f_light;
+varying vec2 f_tile;
 varying vec2 f_coords;
 
 void main(void)
 {
-	f_light = in_params.z;
-	f_coords = in_params.xy;
+	// Each step of corner occlusion takes a fifth off the light.
+	f_light = in_params.z * (1.0 - 0.2 * in_params.w);
+	f_tile = in_params.xy;
 	
-	gl_Position = gl_ModelViewProjectionMatrix * vec4(in_vertex,1.0);
+	// Texture coordinates run across the face, the fragment shader repeats
+	// the tile every block so merged faces don't need extra vertices.
+	vec3 pos = in_vertex.xyz;
+	int face = int(in_vertex.w);
+	if( face == 0 ) f_coords = vec2( pos.x, -pos.z ); // Top
+	else if( face == 1 ) f_coords = vec2( -pos.z, pos.x ); // Bottom
+	else if( face == 2 ) f_coords = vec2( pos.z, -pos.y ); // Left
+	else if( face == 3 ) f_coords = vec2( -pos.z, -pos.y ); // Right
+	else f_coords = vec2( -pos.x, -pos.y ); // Forward & Back
+	
+	gl_Position = gl_ModelViewProjectionMatrix * vec4(pos + in_offset,1.0);
 }
@@ -7,7 +7,6 @@
 
 
 BaseBlock::BaseBlock()
-: mDataFlags( 0 )
 {
 }
 
@@ -15,11 +14,6 @@ BaseBlock::~BaseBlock(void)
 {
 }
 
-void BaseBlock::_setPosition( unsigned short x, unsigned  short y, unsigned short z)
-{
-	//mDataFlags = ( x | (z<<4) | (y<<8) );
-}
-
 void BaseBlock::connectedChange( short face )
 {
 
@@ -37,17 +31,6 @@ short BaseBlock::getZ() {
 	return ((mDataFlags & BMASK_ZPOS)>>4);
 }*/
 
-void BaseBlock::updateVisFlags(unsigned int flags)
-{
-	mDataFlags = (mDataFlags & ~BMASK_VISFLAGS) | (mDataFlags & ~(FACE_ALL<<0));
-	mDataFlags = mDataFlags | (flags<<0);
-}
-
-unsigned short BaseBlock::getVisFlags()
-{
-	return ((mDataFlags & BMASK_VISFLAGS)>>0);
-}
-
 void BaseBlock::getTextureCoords( short face, short &x, short &y )
 {
 	x = 0;
@@ -65,13 +48,3 @@ void BaseBlock::setPosition( const Vector3& vec)
 {
 	setPosition( vec.x, vec.y, vec.z );
 }*/
-
-void BaseBlock::appendToStream( std::ofstream& stream )
-{
-	stream.write( (char *) &mDataFlags, sizeof( mDataFlags ) );	
-}
-
-void BaseBlock::readFromStream( std::ifstream& stream )
-{
-	stream.read( (char *) &mDataFlags, sizeof( mDataFlags ) );	
-}
@@ -4,17 +4,28 @@
 // == Block Factories
 
 BaseBlockFactory::BaseBlockFactory( std::string type )
+: blockType( NULL )
 { 
 	typeName = type; 
 	// Register this factory with the factory manager.
 	FactoryManager::getManager().registerFactory( this );
 }
 
+BaseBlockFactory::~BaseBlockFactory()
+{
+	delete blockType;
+}
+
 std::string BaseBlockFactory::getType() 
 { 
 	return typeName; 
 }
 
+BaseBlock* BaseBlockFactory::getBlockType()
+{
+	return blockType;
+}
+
 BaseBlock* BaseBlockFactory::create() 
 { 
 	Util::log("Error: Create called on BaseFactory :- use GenericFactory instead."); 
@@ -0,0 +1,224 @@
+#include "BlockStorage.h"
+#include "BaseBlock.h"
+
+namespace Magnetite
+{
+	BlockStorage::BlockStorage()
+	: mStatefulIndex( EmptyIndex ),
+	mIndices( nullptr ),
+	mBits( 0 ),
+	mShift( 0 )
+	{
+		PaletteEntry air = { NULL, 0 };
+		mPalette.push_back( air );
+	}
+
+	BlockStorage::~BlockStorage()
+	{
+		for( auto it = mStateful.begin(); it != mStateful.end(); ++it )
+		{
+			delete it->second;
+		}
+		delete[] mIndices;
+	}
+
+	void BlockStorage::_resize( uint8_t bits )
+	{
+		size_t words = ( CHUNK_SIZE * bits ) / 64;
+		uint64_t* indices = new uint64_t[words];
+		memset( indices, 0, sizeof( uint64_t ) * words );
+
+		uint8_t shift = 0;
+		while( ( 64 >> shift ) > bits ) shift++;
+
+		if( mIndices != nullptr )
+		{
+			for( size_t i = 0; i < CHUNK_SIZE; i++ )
+			{
+				uint64_t entry = getIndex( i );
+				indices[ i >> shift ] |= entry << ( ( i & ( ( 1 << shift ) - 1 ) ) * bits );
+			}
+			delete[] mIndices;
+		}
+
+		mIndices = indices;
+		mBits = bits;
+		mShift = shift;
+	}
+
+	BlockStorage::PaletteIndex BlockStorage::_acquireEntry( BlockPtr block )
+	{
+		PaletteIndex entry = EmptyIndex;
+
+		if( block->hasState() )
+		{
+			if( mStatefulIndex != EmptyIndex ) return mStatefulIndex;
+		}
+		else
+		{
+			// The palette is small, a linear search is fine.
+			for( size_t i = 1; i < mPalette.size(); i++ )
+			{
+				if( mPalette[i].block == block )
+				{
+					return i;
+				}
+			}
+		}
+
+		PaletteEntry e = { block->hasState() ? NULL : block, 0 };
+		if( mFreeEntries.size() > 0 )
+		{
+			entry = mFreeEntries.back();
+			mFreeEntries.pop_back();
+			mPalette[entry] = e;
+		}
+		else
+		{
+			entry = mPalette.size();
+			mPalette.push_back( e );
+		}
+
+		if( block->hasState() )
+		{
+			mStatefulIndex = entry;
+		}
+
+		// Widen the indices if the palette has outgrown them.
+		uint8_t bits = std::max<uint8_t>( mBits, 1 );
+		while( mPalette.size() > ( 1u << bits ) ) bits *= 2;
+		if( bits != mBits )
+		{
+			_resize( bits );
+		}
+
+		return entry;
+	}
+
+	void BlockStorage::_releaseEntry( PaletteIndex entry )
+	{
+		PaletteEntry& e = mPalette[entry];
+		if( --e.references > 0 ) return;
+
+		if( entry == mStatefulIndex )
+		{
+			mStatefulIndex = EmptyIndex;
+		}
+		e.block = NULL;
+		mFreeEntries.push_back( entry );
+	}
+
+	void BlockStorage::_setIndex( size_t index, PaletteIndex entry )
+	{
+		if( mIndices == nullptr )
+		{
+			if( entry == EmptyIndex ) return;
+			_resize( 1 );
+		}
+		uint64_t& word = mIndices[ index >> mShift ];
+		size_t offset = ( index & ( ( 1 << mShift ) - 1 ) ) * mBits;
+		uint64_t mask = ( ( 1ull << mBits ) - 1 ) << offset;
+		word = ( word & ~mask ) | ( ( (uint64_t)entry << offset ) & mask );
+	}
+
+	BlockPtr BlockStorage::set( size_t index, BlockPtr block )
+	{
+		PaletteIndex old = getIndex( index );
+		PaletteIndex entry = EmptyIndex;
+
+		// Acquire the new entry before releasing the old one, so re-setting the
+		// same type doesn't recycle the entry.
+		if( block != NULL )
+		{
+			entry = _acquireEntry( block );
+			mPalette[entry].references++;
+		}
+
+		if( old != EmptyIndex )
+		{
+			if( old == mStatefulIndex )
+			{
+				auto it = mStateful.find( index );
+				if( it != mStateful.end() )
+				{
+					if( it->second != block ) delete it->second;
+					mStateful.erase( it );
+				}
+			}
+			_releaseEntry( old );
+		}
+
+		if( block != NULL && entry == mStatefulIndex )
+		{
+			mStateful[index] = block;
+		}
+
+		_setIndex( index, entry );
+
+		return block;
+	}
+
+	void BlockStorage::remove( size_t index )
+	{
+		set( index, NULL );
+	}
+
+	void BlockStorage::getRowMasks( uint32_t* solid, uint32_t* opaque ) const
+	{
+		static_assert( CHUNK_WIDTH == 32, "row masks hold a row of voxels in each 32 bit word" );
+		const size_t rows = CHUNK_SIZE / CHUNK_WIDTH;
+		memset( solid, 0, sizeof( uint32_t ) * rows );
+		memset( opaque, 0, sizeof( uint32_t ) * rows );
+		if( mIndices == nullptr ) return;
+
+		// Ask each block type once rather than every voxel.
+		std::vector<uint8_t> opaqueEntries( mPalette.size(), 0 );
+		for( size_t i = 1; i < mPalette.size(); i++ )
+		{
+			if( mPalette[i].block != NULL && mPalette[i].block->isOpaque() ) opaqueEntries[i] = 1;
+		}
+
+		size_t index = 0;
+		for( size_t r = 0; r < rows; r++ )
+		{
+			uint32_t s = 0, o = 0;
+			for( uint32_t x = 0; x < CHUNK_WIDTH; x++, index++ )
+			{
+				PaletteIndex entry = getIndex( index );
+				if( entry == EmptyIndex ) continue;
+
+				bool isOpaque = opaqueEntries[entry] != 0;
+				if( entry == mStatefulIndex )
+				{
+					BlockPtr block = get( index );
+					if( block == NULL ) continue;
+					isOpaque = block->isOpaque();
+				}
+
+				s |= 1u << x;
+				if( isOpaque ) o |= 1u << x;
+			}
+			solid[r] = s;
+			opaque[r] = o;
+		}
+	}
+
+	size_t BlockStorage::getPaletteSize() const
+	{
+		return mPalette.size() - mFreeEntries.size();
+	}
+
+	uint8_t BlockStorage::getIndexBits() const
+	{
+		return mBits;
+	}
+
+	size_t BlockStorage::getMemoryUsage() const
+	{
+		size_t bytes = sizeof( BlockStorage );
+		bytes += ( CHUNK_SIZE * mBits ) / 8;
+		bytes += mPalette.capacity() * sizeof( PaletteEntry );
+		bytes += mStateful.size() * ( sizeof( BlockList::value_type ) + 4 * sizeof( void* ) );
+		return bytes;
+	}
+};
@@ -16,6 +16,7 @@ mPitch ( 0 )
 	mViewFrustum.setCamera(this);
 	setPosition(Vector3());
 	setViewDistance( 400.f );
+	_updatePagingView();
 }
 
 Camera::~Camera(void)
@@ -54,6 +55,15 @@ Vector3 Camera::getForward()
 	return glm::normalize( getOrientationMatrix() * glm::vec3( 0.f, 0.f, -1.f ) );
 }
 
+void Camera::_updatePagingView()
+{
+	// The cone has to cover the corners of the frustum, not just the vertical fov.
+	float halfFov = mViewFrustum.getFov() * 0.5f * 3.1415926f / 180.f;
+	float aspect = mViewFrustum.getAspectRatio();
+	setViewAngle( atan( tan( halfFov ) * sqrt( 1.f + aspect * aspect ) ) );
+	setDirection( getForward() );
+}
+
 void Camera::applyMatrix( bool rot, bool pos ) 
 {
 	glMatrixMode(GL_MODELVIEW);
@@ -100,6 +110,7 @@ void Camera::setPitch( float p )
 {
 	mPitch = std::max<float>( std::min<float>( p, 90 ), -90 );
 	mViewFrustum.updatePlanes();
+	_updatePagingView();
 }
 
 void Camera::setYaw( float y )
@@ -110,6 +121,7 @@ void Camera::setYaw( float y )
 	while( mYaw < -360 )
 		mYaw += 360;
 	mViewFrustum.updatePlanes();
+	_updatePagingView();
 }
 
 float Camera::getPitch()
@@ -8,44 +8,116 @@
 #include "World.h"
 #include "Renderer.h"
 #include <BaseTriangulator.h>
+#include <GreedyTriangulator.h>
 #include <util.h>
 
 #include "Geometry.h"
 
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+
+/**
+ * Returns the number of bits set in a row of blocks.
+ */
+static inline int countBits( uint32_t bits )
+{
+#if defined( __GNUC__ )
+	return __builtin_popcount( bits );
+#elif defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+	return __popcnt( bits );
+#else
+	bits = bits - ( ( bits >> 1 ) & 0x55555555 );
+	bits = ( bits & 0x33333333 ) + ( ( bits >> 2 ) & 0x33333333 );
+	return ( ( ( bits + ( bits >> 4 ) ) & 0x0F0F0F0F ) * 0x01010101 ) >> 24;
+#endif
+}
+
+/**
+ * Returns the index of the lowest bit set, bits must not be 0.
+ */
+static inline int lowestBit( uint32_t bits )
+{
+#if defined( __GNUC__ )
+	return __builtin_ctz( bits );
+#elif defined( _MSC_VER )
+	unsigned long index;
+	_BitScanForward( &index, bits );
+	return index;
+#else
+	int index = 0;
+	while( ( bits & 1 ) == 0 )
+	{
+		bits >>= 1;
+		index++;
+	}
+	return index;
+#endif
+}
 
 BaseBlock* Chunk::getBlockAtWorld( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 {
-	if( x < 0 || y < 0 || z < 0 || x / CHUNK_WIDTH != mWorldIndex.x || y / CHUNK_HEIGHT != mWorldIndex.y || z / CHUNK_WIDTH != mWorldIndex.z ) return mWorld->getBlockAt(x,y,z);
+	if( x < 0 || y < 0 || z < 0 || x / CHUNK_WIDTH != mWorldIndex.x || y / CHUNK_HEIGHT != mWorldIndex.y || z / CHUNK_WIDTH != mWorldIndex.z )
+	{
+		if( _hasChunkFlag( Detached ) ) return NULL;
+		return mWorld->getBlockAt(x,y,z);
+	}
 	auto id = (z%CHUNK_WIDTH) * CHUNK_WIDTH * CHUNK_HEIGHT + (y%CHUNK_HEIGHT) * CHUNK_WIDTH + (x%CHUNK_WIDTH);
-	return mBlocks[id];
+	return mBlocks.get( id );
 }
 
 Chunk::Chunk( ChunkIndex index, World* world )
 : mWorld( world ),
-mGeometry (NULL),
+mMeshing( false ),
+mMeshRequested( false ),
+mLodRequested( false ),
 mChunkFlags( 0 ),
 mPhysicsShape( NULL ),
 mPhysicsState( NULL ),
 mPhysicsMesh( NULL ),
 mPhysicsBody( NULL ),
-mNumBlocks( 0 )
+mNumBlocks( 0 ),
+mGeneration( 0 ),
+mSavedGeneration( 0 ),
+mConnectivity( 0xFFFFFFFF ),
+mVisibleStamp( 0 )
 {
+	for( size_t l = 0; l < CHUNK_LOD_LEVELS; l++ )
+	{
+		mGeometry[l] = NULL;
+	}
 	mVisibleFaces = 0;
+	mFluidLevels = NULL;
 	mWorldIndex = index;
 	
 	// Allocates the internal block array 
 	_allocateArray( CHUNK_SIZE );
 }
 
+/**
+ * Hands geometry to the renderer to be deleted once it can't be in use.
+ */
+static void retireGeometry( TerrainGeometry* geometry )
+{
+	if( geometry == NULL ) return;
+	if( CoreSingleton != NULL && CoreSingleton->getRenderer() != NULL )
+	{
+		CoreSingleton->getRenderer()->retireGeometry( geometry );
+	}
+	else
+	{
+		delete geometry;
+	}
+}
+
 Chunk::~Chunk()
 {
-	for( size_t i = 0; i < CHUNK_SIZE; i ++ )
+	for( size_t l = 0; l < CHUNK_LOD_LEVELS; l++ )
 	{
-		if( mBlocks[i] != nullptr )
-			delete mBlocks[i];
+		retireGeometry( mGeometry[l].exchange( NULL ) );
 	}
-	delete[] mBlocks;
 	delete[] mLightValues;
+	delete[] mFluidLevels;
 }
 
 long Chunk::getX()
@@ -70,14 +142,11 @@ World* Chunk::getWorld()
 
 void Chunk::_allocateArray( size_t size )
 {
-	mBlocks = new BlockPtr[size];
-	memset( mBlocks, 0, sizeof( BlockPtr ) * size );
-	
 	mLightValues = new LightIndex[size];
-	memset( mBlocks, 0, sizeof( LightIndex ) * size );
+	memset( mLightValues, 0, sizeof( LightIndex ) * size );
 }
 
-BlockPtr* Chunk::getBlocks()
+Magnetite::BlockStorage& Chunk::getBlocks()
 {
 	return mBlocks;
 }
@@ -89,21 +158,45 @@ void Chunk::removeBlockAt( short x, short y, short z )
 
 void Chunk::removeBlockAt( short index )
 {
+	if( index < 0 || index >= CHUNK_SIZE )
+		return;
+	
 	getMutex().lock();
 	
-	if( index < 0 || index > CHUNK_SIZE )
-		return;
-	BlockList::iterator it = mVisibleBlocks.find( index );
-	if( it != mVisibleBlocks.end() )
-		mVisibleBlocks.erase( it );
-	delete mBlocks[index];
-	mNumBlocks--;
-	mBlocks[index] = NULL;
-	_raiseChunkFlag( DataUpdated );
+	if( mBlocks.getIndex( index ) != Magnetite::BlockStorage::EmptyIndex )
+	{
+		// Hide the block until the list is rebuilt.
+		auto it = std::lower_bound( mVisibleBlocks.indices.begin(), mVisibleBlocks.indices.end(), index );
+		if( it != mVisibleBlocks.indices.end() && *it == index )
+			mVisibleBlocks.faces[ it - mVisibleBlocks.indices.begin() ] = 0;
+		mBlocks.remove( index );
+		if( mFluidLevels != NULL )
+			mFluidLevels[index] = 100;
+		mNumBlocks--;
+		mGeneration++;
+		_raiseChunkFlag( DataUpdated );
+	}
 	
 	getMutex().unlock();
 }
 
+float Chunk::getFluidLevel( const size_t index )
+{
+	if( mFluidLevels == NULL ) return 100.f;
+	return mFluidLevels[index];
+}
+
+void Chunk::setFluidLevel( const size_t index, float level )
+{
+	if( mFluidLevels == NULL )
+	{
+		if( level >= 100.f ) return;
+		mFluidLevels = new uint8_t[CHUNK_SIZE];
+		memset( mFluidLevels, 100, sizeof( uint8_t ) * CHUNK_SIZE );
+	}
+	mFluidLevels[index] = (uint8_t)std::max( 0.f, std::min( level, 100.f ) );
+}
+
 bool Chunk::hasNeighbours( long x, long y, long z )
 {
 	if( x == 0 || y == 0 || z == 0 ) return true;
@@ -122,82 +215,227 @@ size_t Chunk::getVisibleFaceCount()
     return mVisibleFaces;
 }
 
-BlockList& Chunk::getVisibleBlocks()
+VisibleBlockList& Chunk::getVisibleBlocks()
 {
 	return mVisibleBlocks;
 }
 
-#define CHECK_FACE( cond, dx, dy, dz, face ) \
-	if( cond || mWorld->getChunk( getX() + dx, getY() + dy, getZ() + dz ) != nullptr ) \
-	{\
-		cb = getBlockAtWorld( blockX + dx, blockY + dy, blockZ + dz );\
-		if( cb == NULL || !cb->isOpaque() ) {\
-			mVisibleFaces++;\
-			visFlags |= face;\
-		}\
+/**
+ * Direction of each face, in FACE_INDEX_ order.
+ */
+static const int faceDirections[FACE_COUNT][3] = {
+	{ 0, 1, 0 }, { 0, -1, 0 },
+	{ -1, 0, 0 }, { 1, 0, 0 },
+	{ 0, 0, -1 }, { 0, 0, 1 }
+};
+
+void Chunk::_getOpaqueSlice( int face, uint32_t* slice )
+{
+	// Words follow the axis that isn't in a row of the masks, so the slice
+	// lines up with the rows that touch it.
+	long p[3] = { 0, 0, 0 };
+	long *word = &p[2], *bit = &p[0];
+	switch( face )
+	{
+		case FACE_INDEX_TOP: p[1] = CHUNK_HEIGHT - 1; break;
+		case FACE_INDEX_BOTTOM: break;
+		case FACE_INDEX_LEFT: bit = &p[1]; break;
+		case FACE_INDEX_RIGHT: p[0] = CHUNK_WIDTH - 1; bit = &p[1]; break;
+		case FACE_INDEX_FORWARD: word = &p[1]; break;
+		case FACE_INDEX_BACK: p[2] = CHUNK_WIDTH - 1; word = &p[1]; break;
 	}
+	
+	for( *word = 0; *word < CHUNK_WIDTH; (*word)++ )
+	{
+		uint32_t opaque = 0;
+		for( *bit = 0; *bit < CHUNK_WIDTH; (*bit)++ )
+		{
+			BaseBlock* b = mBlocks.get( BLOCK_INDEX_2( p[0], p[1], p[2] ) );
+			if( b != nullptr && b->isOpaque() ) opaque |= 1u << *bit;
+		}
+		slice[*word] = opaque;
+	}
+}
 
 void Chunk::updateVisibility( )
 {
-	BaseBlock* b = nullptr;
-	BaseBlock* cb = nullptr;
-	short visFlags = 0;
-	BlockList::iterator it;
+	if( _hasChunkFlag( DataUpdated ) )
+	{
+		_updateConnectivity();
+		mVisibleBlocks.clear();
+		mVisibleFaces = 0;
+		
+		// Empty chunks still need lighting, sunlight passes through them to
+		// the chunks below, and a chunk that was dug out needs its old mesh
+		// replaced.
+		_raiseChunkFlag( MeshInvalid );
+	}
 	
 	if( _hasChunkFlag( DataUpdated ) && getBlockCount() > 0 )
 	{
-		size_t id = 0;
-		mVisibleFaces = 0;
-		ChunkScalar worldX = getX() * CHUNK_WIDTH;
-		ChunkScalar worldY = getY() * CHUNK_HEIGHT;
-		ChunkScalar worldZ = getZ() * CHUNK_WIDTH;
-		ChunkScalar blockX = 0;
-		ChunkScalar blockY = 0;
-		ChunkScalar blockZ = 0;
+		const size_t rows = CHUNK_SIZE / CHUNK_WIDTH;
+		uint32_t solid[rows], opaque[rows];
+		mBlocks.getRowMasks( solid, opaque );
 		
-		bool fc = getBlockCount() == CHUNK_SIZE;
+		// The layer of each neighbour touching this chunk. Faces against
+		// chunks that aren't loaded stay hidden until they are.
+		uint32_t slices[FACE_COUNT][CHUNK_WIDTH];
+		for( int f = 0; f < FACE_COUNT; f++ )
+		{
+			Chunk* neighbour = mWorld->getChunk( getX() + faceDirections[f][0], getY() + faceDirections[f][1], getZ() + faceDirections[f][2] );
+			if( neighbour == nullptr )
+			{
+				std::fill( slices[f], slices[f] + CHUNK_WIDTH, 0xFFFFFFFF );
+			}
+			else
+			{
+				neighbour->_getOpaqueSlice( f ^ 1, slices[f] );
+			}
+		}
 		
 		for( long z = 0; z < CHUNK_WIDTH; z++ ) {
 			for( long y = 0; y < CHUNK_HEIGHT; y++ ) {
-				for( long x = 0; x < CHUNK_WIDTH; x++ ) {
-					id = BLOCK_INDEX_2( x, y, z );
-					b = mBlocks[id];
-					if( b == nullptr ) { continue; }
-					if( fc && ( x > 0 && x < CHUNK_WIDTH-1 && y > 0 && y < CHUNK_HEIGHT-1 && z > 0 && z < CHUNK_WIDTH-1 ) ) { continue; }
+				size_t r = z * CHUNK_HEIGHT + y;
+				uint32_t s = solid[r];
 				
-					blockX = worldX + x; blockY = worldY + y; blockZ = worldZ + z;
-					
-					visFlags = 0;
-					//Check All axes for adjacent blocks.
-					CHECK_FACE( x < CHUNK_WIDTH-1,  1, 0, 0, FACE_RIGHT );
-					
-					CHECK_FACE( x > 0,             -1, 0, 0, FACE_LEFT );
-					
-					CHECK_FACE( y < CHUNK_HEIGHT-1, 0, 1, 0, FACE_TOP );
-					
-					CHECK_FACE( y > 0,              0,-1, 0, FACE_BOTTOM );
-					
-					CHECK_FACE( z < CHUNK_WIDTH-1,  0, 0, 1, FACE_BACK );
-					
-					CHECK_FACE( z > 0,              0, 0,-1, FACE_FORWARD );
+				// A face is visible where the block next to it isn't opaque.
+				uint32_t visible[FACE_COUNT];
+				visible[FACE_INDEX_RIGHT] = s & ~( ( opaque[r] >> 1 ) | ( ( ( slices[FACE_INDEX_RIGHT][z] >> y ) & 1 ) << ( CHUNK_WIDTH - 1 ) ) );
+				visible[FACE_INDEX_LEFT] = s & ~( ( opaque[r] << 1 ) | ( ( slices[FACE_INDEX_LEFT][z] >> y ) & 1 ) );
+				visible[FACE_INDEX_TOP] = s & ~( y < CHUNK_HEIGHT-1 ? opaque[r + 1] : slices[FACE_INDEX_TOP][z] );
+				visible[FACE_INDEX_BOTTOM] = s & ~( y > 0 ? opaque[r - 1] : slices[FACE_INDEX_BOTTOM][z] );
+				visible[FACE_INDEX_BACK] = s & ~( z < CHUNK_WIDTH-1 ? opaque[r + CHUNK_HEIGHT] : slices[FACE_INDEX_BACK][y] );
+				visible[FACE_INDEX_FORWARD] = s & ~( z > 0 ? opaque[r - CHUNK_HEIGHT] : slices[FACE_INDEX_FORWARD][y] );
+				
+				uint32_t any = 0;
+				for( int f = 0; f < FACE_COUNT; f++ )
+				{
+					any |= visible[f];
+					mVisibleFaces += countBits( visible[f] );
+				}
+				
+				for( uint32_t bits = any; bits != 0; bits &= bits - 1 )
+				{
+					long x = lowestBit( bits );
+					uint8_t visFlags = 0;
+					for( int f = 0; f < FACE_COUNT; f++ )
+					{
+						visFlags |= ( ( visible[f] >> x ) & 1 ) << f;
+					}
+					mVisibleBlocks.push_back( r * CHUNK_WIDTH + x, visFlags );
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Returns the bit in mConnectivity for a pair of faces.
+ */
+static inline uint32_t connectionBit( int a, int b )
+{
+	return a < b ? 1 << ( a * FACE_COUNT + b ) : 1 << ( b * FACE_COUNT + a );
+}
+
+bool Chunk::isConnected( int faceA, int faceB )
+{
+	if( faceA == faceB ) return true;
+	return ( mConnectivity & connectionBit( faceA, faceB ) ) != 0;
+}
+
+void Chunk::_updateConnectivity()
+{
+	uint32_t connectivity = 0;
+	
+	if( getBlockCount() == 0 )
+	{
+		connectivity = 0xFFFFFFFF;
+	}
+	else
+	{
+		// 0 for opaque or already filled, 1 for open.
+		const size_t rows = CHUNK_SIZE / CHUNK_WIDTH;
+		uint32_t solid[rows], opaque[rows];
+		mBlocks.getRowMasks( solid, opaque );
+		std::vector<uint8_t> open( CHUNK_SIZE );
+		for( size_t i = 0; i < CHUNK_SIZE; i++ )
+		{
+			open[i] = ( ( opaque[i / CHUNK_WIDTH] >> ( i % CHUNK_WIDTH ) ) & 1 ) ? 0 : 1;
+		}
+		
+		std::vector<uint16_t> queue( CHUNK_SIZE );
+		for( long z = 0; z < CHUNK_WIDTH; z++ ) {
+			for( long y = 0; y < CHUNK_HEIGHT; y++ ) {
+				for( long x = 0; x < CHUNK_WIDTH; x++ ) {
+					// Only spaces that reach a face can connect two of them.
+					bool edge = x == 0 || y == 0 || z == 0 || x == CHUNK_WIDTH-1 || y == CHUNK_HEIGHT-1 || z == CHUNK_WIDTH-1;
+					size_t start = BLOCK_INDEX_2( x, y, z );
+					if( !edge || !open[start] ) continue;
 					
-					if( b->getVisFlags() != visFlags ) {
-						// Check to see if we need to change the VB data.
-						if( visFlags > 0 && b->getVisFlags() == 0 ) {
-							mVisibleBlocks.insert( BlockList::value_type( id, b ) );
+					// Fill this space, recording which faces it touches.
+					uint8_t faces = 0;
+					size_t head = 0, tail = 0;
+					queue[tail++] = start;
+					open[start] = 0;
+					while( head < tail )
+					{
+						size_t id = queue[head++];
+						long bx = id % CHUNK_WIDTH;
+						long by = ( id / CHUNK_WIDTH ) % CHUNK_HEIGHT;
+						long bz = id / ( CHUNK_WIDTH * CHUNK_HEIGHT );
+						
+						if( bx == 0 ) faces |= FACE_LEFT;
+						if( bx == CHUNK_WIDTH-1 ) faces |= FACE_RIGHT;
+						if( by == 0 ) faces |= FACE_BOTTOM;
+						if( by == CHUNK_HEIGHT-1 ) faces |= FACE_TOP;
+						if( bz == 0 ) faces |= FACE_FORWARD;
+						if( bz == CHUNK_WIDTH-1 ) faces |= FACE_BACK;
+						
+						size_t next[6];
+						size_t count = 0;
+						if( bx > 0 ) next[count++] = id - 1;
+						if( bx < CHUNK_WIDTH-1 ) next[count++] = id + 1;
+						if( by > 0 ) next[count++] = id - CHUNK_WIDTH;
+						if( by < CHUNK_HEIGHT-1 ) next[count++] = id + CHUNK_WIDTH;
+						if( bz > 0 ) next[count++] = id - CHUNK_WIDTH * CHUNK_HEIGHT;
+						if( bz < CHUNK_WIDTH-1 ) next[count++] = id + CHUNK_WIDTH * CHUNK_HEIGHT;
+						for( size_t n = 0; n < count; n++ )
+						{
+							if( open[next[n]] )
+							{
+								open[next[n]] = 0;
+								queue[tail++] = next[n];
+							}
 						}
-						else if( visFlags == 0 && b->getVisFlags() > 0 )
+					}
+					
+					for( int a = 0; a < FACE_COUNT; a++ )
+					{
+						if( ( faces & ( 1 << a ) ) == 0 ) continue;
+						for( int b = a + 1; b < FACE_COUNT; b++ )
 						{
-							it = mVisibleBlocks.find( id );
-							mVisibleBlocks.erase( it );
+							if( faces & ( 1 << b ) ) connectivity |= connectionBit( a, b );
 						}
-						b->updateVisFlags(visFlags);
 					}
 				}
 			}
 		}
-		_raiseChunkFlag( MeshInvalid );
 	}
+	
+	if( mConnectivity.exchange( connectivity ) != connectivity )
+	{
+		mWorld->_invalidateVisibility();
+	}
+}
+
+uint32_t Chunk::_getVisibleStamp()
+{
+	return mVisibleStamp;
+}
+
+void Chunk::_setVisibleStamp( uint32_t stamp )
+{
+	mVisibleStamp = stamp;
 }
 
 void Chunk::requestGenerate()
@@ -209,66 +447,124 @@ void Chunk::requestGenerate()
 		Perf::Profiler::get().end("vupdate");
 		if( _hasChunkFlag( MeshInvalid ) )
 		{
-			generate();
+			// Lighting must be done before geometry
+			Perf::Profiler::get().begin("lupdate");
+			bool lit = generateLighting();
+			Perf::Profiler::get().end("lupdate");
+			
+			// A neighbour is busy, everything is tried again next update.
+			if( !lit ) return;
+			mMeshRequested = true;
 			_lowerChunkFlag( MeshInvalid );
 		}
 		_lowerChunkFlag( DataUpdated );
 	}
+	
+	if( mLodRequested && !mMeshing ) mMeshRequested = true;
+	
+	// Only one mesh is built at a time, anything that changes while it is
+	// building is picked up by the next one.
+	if( mMeshRequested && !mMeshing && mWorld->isMeshWanted( this ) )
+	{
+		// Neighbours can only be unloaded by this thread, so their edges
+		// are copied here rather than on the worker.
+		std::shared_ptr<Magnetite::ChunkNeighbourhood> hood( new Magnetite::ChunkNeighbourhood() );
+		if( !hood->gatherBorder( this ) ) return;
+		
+		// Chunks near the camera are never drawn coarser, so they skip the
+		// lower detail meshes until the renderer asks for them.
+		bool lods = mLodRequested.exchange( false ) || mWorld->isLodWanted( this );
+		mMeshRequested = false;
+		mMeshing = true;
+		mWorld->requestMesh( this, hood, lods );
+	}
 }
 
-GeometryPtr Chunk::getGeometry()
+TerrainGeometry* Chunk::getGeometry( size_t level )
 {
-	return mGeometry;
+	return mGeometry[level].load();
 }
 
-void Chunk::generate()
+bool Chunk::isMeshing()
+{
+	return mMeshing;
+}
+
+void Chunk::requestLod()
+{
+	// A mesh being built may already have them.
+	if( !mMeshing ) mLodRequested = true;
+}
+
+void Chunk::generate( BaseTriangulator* triangulator, Magnetite::ChunkNeighbourhood& hood, bool lods )
 {
-	// Lighting must be done before geometry
-	Perf::Profiler::get().begin("lupdate");
-	generateLighting();
-	Perf::Profiler::get().end("lupdate");
-	
 	Perf::Profiler::get().begin("cgupdate");
-	generateGeometry();
+	// The world thread only try_locks chunks, so it skips this one until the mesh is built.
+	getMutex().lock();
+	hood.gatherChunk( this );
+	TerrainGeometry* geometry = generateGeometry( triangulator, hood );
+	TerrainGeometry* lodGeometry[CHUNK_LOD_LEVELS];
+	for( size_t l = 1; l < CHUNK_LOD_LEVELS; l++ )
+	{
+		GreedyTriangulator lod( 1 << l );
+		lodGeometry[l] = lods ? generateGeometry( &lod, hood ) : NULL;
+	}
 	Perf::Profiler::get().end("cgupdate");
+	getMutex().unlock();
 	
 	Perf::Profiler::get().begin("pupdate");
 	// generate physics - geometry must already be generated
-	generatePhysics();
+	generatePhysics( geometry );
 	Perf::Profiler::get().end("pupdate");
+	
+	// The renderer keeps drawing the old meshes until this point.
+	retireGeometry( mGeometry[0].exchange( geometry ) );
+	for( size_t l = 1; l < CHUNK_LOD_LEVELS; l++ )
+	{
+		retireGeometry( mGeometry[l].exchange( lodGeometry[l] ) );
+	}
+	mMeshing = false;
 }
 
-void Chunk::generateGeometry()
+TerrainGeometry* Chunk::generateGeometry( BaseTriangulator* triangulator, const Magnetite::ChunkNeighbourhood& hood )
 {
-	if( mGeometry == NULL ) 
-	{
-		mGeometry = new TerrainGeometry();
-	}
-	else
-	{
-		delete mGeometry;
-		mGeometry = new TerrainGeometry();
-	}
+	TerrainGeometry* geometry = new TerrainGeometry();
 	
 	if( mVisibleBlocks.size() > 0 )
 	{
-		mWorld->getTriangulator()->triangulateChunk(mGeometry, this);
+		triangulator->triangulateChunk( geometry, this, hood );
 	}
+	
+	return geometry;
 }
 
-void Chunk::generateLighting()
+bool Chunk::generateLighting()
 {
 	if( !_hasChunkFlag( SkipLight ) )
 	{
-		LightingManager::lightChunk( this );
+		// This chunk is already locked, so neighbours are only try_locked.
+		Magnetite::ChunkNeighbourhood hood;
+		if( !hood.gatherBorder( this ) ) return false;
+		hood.gatherChunk( this );
+		int faces = LightingManager::lightChunk( this, hood );
+		
+		// Neighbours lit against the old light on this chunk's edges are
+		// lit again, so light settles whatever order chunks are lit in.
+		for( int f = 0; f < FACE_COUNT; f++ )
+		{
+			if( ( faces & ( 1 << f ) ) == 0 ) continue;
+			Chunk* neighbour = mWorld->getChunk( getX() + faceDirections[f][0], getY() + faceDirections[f][1], getZ() + faceDirections[f][2] );
+			if( neighbour != nullptr ) neighbour->_raiseChunkFlag( DataUpdated );
+		}
 	}
 	else
 	{
 		_lowerChunkFlag( SkipLight );
 	}
+	return true;
 }
 
-void Chunk::generatePhysics()
+void Chunk::generatePhysics( TerrainGeometry* geometry )
 {
 	if( mPhysicsBody != NULL )
 	{
@@ -278,35 +574,37 @@ void Chunk::generatePhysics()
 		CoreSingleton->getPhysicsWorld()
 			->removeRigidBody( p );
 		CoreSingleton->physicsMutex.unlock();
+		delete p;
 		delete mPhysicsState;
-		delete mPhysicsBody;
 		delete mPhysicsShape;
 		delete mPhysicsMesh;
+		// An empty mesh creates nothing new, so nothing may be left dangling.
+		mPhysicsState = NULL;
+		mPhysicsShape = NULL;
+		mPhysicsMesh = NULL;
 	}
 	
-	if( mGeometry->vertexCount > 0 && mGeometry->edgeData > 0 )
+	if( geometry->vertexCount > 0 && geometry->edgeData != NULL )
 	{
 		if( getBlockCount() < CHUNK_SIZE )
 		{
-			btTriangleIndexVertexArray* meshInterface = new btTriangleIndexVertexArray;
-			btIndexedMesh part;
-
-			int vertSize = sizeof( TerrainVertex );
-			int indexSize = sizeof( GLedge );
-
-			part.m_vertexBase = (const unsigned char*)&mGeometry->vertexData[0].x;
-			part.m_vertexStride = vertSize;
-			part.m_numVertices = mGeometry->vertexCount;
-			part.m_vertexType = PHY_FLOAT;
-			part.m_triangleIndexBase = (const unsigned char*)&mGeometry->edgeData[0];
-			part.m_triangleIndexStride = indexSize * 3;
-			part.m_numTriangles = mGeometry->edgeCount / 3;
-			part.m_indexType = PHY_SHORT;
-
-			meshInterface->addIndexedMesh( part, PHY_SHORT );
+			// Bullet needs float positions, so the packed vertices are
+			// copied into a mesh the chunk owns.
+			mPhysicsMesh = new btTriangleMesh();
+			mPhysicsMesh->preallocateVertices( geometry->edgeCount );
+			
+			TerrainVertex* verts = geometry->vertexData;
+			GLedge* edges = geometry->edgeData;
+			for( size_t e = 0; e + 2 < geometry->edgeCount; e += 3 )
+			{
+				const TerrainVertex& a = verts[ edges[e] ];
+				const TerrainVertex& b = verts[ edges[e + 1] ];
+				const TerrainVertex& c = verts[ edges[e + 2] ];
+				mPhysicsMesh->addTriangle( btVector3( a.x, a.y, a.z ), btVector3( b.x, b.y, b.z ), btVector3( c.x, c.y, c.z ) );
+			}
 
 			//mPhysicsShape = new btBvhTriangleMeshShape( meshInterface, true );//new btConvexTriangleMeshShape( meshInterface );////new btBoxShape( btVector3(8, 64, 8) );
-			mPhysicsShape = new btBvhTriangleMeshShape( meshInterface, false );
+			mPhysicsShape = new btBvhTriangleMeshShape( mPhysicsMesh, false );
 			mPhysicsState = new btDefaultMotionState(btTransform(btQuaternion(0,0,0,1),btVector3( getX() * CHUNK_WIDTH, getY() * CHUNK_HEIGHT, getZ() * CHUNK_WIDTH)));
 			btRigidBody::btRigidBodyConstructionInfo ci( 0, mPhysicsState, mPhysicsShape, btVector3(0,0,0) );
 			mPhysicsBody = new btRigidBody( ci );
@@ -370,6 +668,21 @@ const size_t Chunk::getBlockCount()
 	return mNumBlocks;
 }
 
+uint32_t Chunk::getGeneration()
+{
+	return mGeneration;
+}
+
+bool Chunk::isModified()
+{
+	return mGeneration != mSavedGeneration;
+}
+
+void Chunk::_markSaved( uint32_t generation )
+{
+	mSavedGeneration = generation;
+}
+
 std::mutex& Chunk::getMutex()
 {
 	return mMutex;
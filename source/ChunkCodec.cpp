@@ -0,0 +1,238 @@
+#include "ChunkCodec.h"
+#include "BuildConfig.h"
+
+#ifdef MAGNETITE_HAS_LZ4
+#include <lz4.h>
+#endif
+
+namespace Magnetite
+{
+	static const char ChunkMagic[4] = { 'M', 'G', 'C', 'K' };
+
+	/**
+	 * Layout of the header at the start of every encoded chunk.
+	 */
+	struct EncodedHeader
+	{
+		char magic[4];
+		uint8_t version;
+		uint8_t form;
+		uint8_t flags;
+		uint8_t reserved;
+		/**
+		 * Length of the payload before any compression.
+		 */
+		uint32_t payloadLength;
+	};
+
+	/**
+	 * Size of the arrays written by versions before the codec existed.
+	 */
+	static const size_t LegacyLength = CHUNK_SIZE * ( sizeof( uint32_t ) + sizeof( LightIndex ) );
+
+	/**
+	 * Largest payload encode can write: a run for every block, each with a
+	 * five byte id and three byte count, then the same for light with one
+	 * byte values. Anything longer in a header is corrupt.
+	 */
+	static const size_t MaxPayloadLength = CHUNK_SIZE * ( 5 + 3 ) + CHUNK_SIZE * ( 1 + 3 );
+
+	static void writeVarint( std::vector<char>& out, uint32_t value )
+	{
+		while( value >= 0x80 )
+		{
+			out.push_back( (char)( ( value & 0x7F ) | 0x80 ) );
+			value >>= 7;
+		}
+		out.push_back( (char)value );
+	}
+
+	static bool readVarint( const char*& data, const char* end, uint32_t& value )
+	{
+		value = 0;
+		for( size_t shift = 0; shift < 35 && data < end; shift += 7 )
+		{
+			uint8_t b = *data++;
+			// The fifth byte only has room for the top 4 bits.
+			if( shift == 28 && b > 0x0F ) return false;
+			value |= (uint32_t)( b & 0x7F ) << shift;
+			if( ( b & 0x80 ) == 0 ) return true;
+		}
+		return false;
+	}
+
+	template<class T> static void writeRuns( std::vector<char>& out, const T* values, bool byteValues )
+	{
+		size_t start = 0;
+		while( start < CHUNK_SIZE )
+		{
+			size_t end = start + 1;
+			while( end < CHUNK_SIZE && values[end] == values[start] ) end++;
+
+			if( byteValues ) out.push_back( (char)values[start] );
+			else writeVarint( out, values[start] );
+			writeVarint( out, end - start );
+
+			start = end;
+		}
+	}
+
+	static bool readRuns( const char*& data, const char* end, bool byteValues, const ChunkRunCallback& callback )
+	{
+		size_t start = 0;
+		while( start < CHUNK_SIZE )
+		{
+			uint32_t value, count;
+			if( byteValues )
+			{
+				if( data >= end ) return false;
+				value = (uint8_t)*data++;
+			}
+			else if( !readVarint( data, end, value ) ) return false;
+
+			if( !readVarint( data, end, count ) || count == 0 || start + count > CHUNK_SIZE ) return false;
+
+			callback( start, count, value );
+			start += count;
+		}
+		return true;
+	}
+
+	void ChunkCodec::encode( const uint32_t* blocks, const LightIndex* light, std::vector<char>& out )
+	{
+		EncodedHeader header;
+		memcpy( header.magic, ChunkMagic, sizeof( ChunkMagic ) );
+		header.version = Version;
+		header.flags = 0;
+		header.reserved = 0;
+
+		bool uniform = true;
+		for( size_t i = 1; i < CHUNK_SIZE && uniform; i++ )
+		{
+			uniform = blocks[i] == blocks[0] && light[i] == light[0];
+		}
+
+		std::vector<char> payload;
+		if( uniform && blocks[0] == 0 && light[0] == 0 )
+		{
+			header.form = Empty;
+		}
+		else if( uniform )
+		{
+			header.form = Uniform;
+			writeVarint( payload, blocks[0] );
+			payload.push_back( (char)light[0] );
+		}
+		else
+		{
+			header.form = RunLength;
+			payload.reserve( 1024 );
+			writeRuns( payload, blocks, false );
+			writeRuns( payload, light, true );
+		}
+		header.payloadLength = payload.size();
+
+#ifdef MAGNETITE_HAS_LZ4
+		if( header.form == RunLength )
+		{
+			std::vector<char> compressed( LZ4_compressBound( payload.size() ) );
+			int length = LZ4_compress_default( payload.data(), compressed.data(), payload.size(), compressed.size() );
+			if( length > 0 && (size_t)length < payload.size() )
+			{
+				compressed.resize( length );
+				payload.swap( compressed );
+				header.flags |= CompressedLZ4;
+			}
+		}
+#endif
+
+		out.resize( sizeof( EncodedHeader ) );
+		memcpy( out.data(), &header, sizeof( EncodedHeader ) );
+		out.insert( out.end(), payload.begin(), payload.end() );
+	}
+
+	bool ChunkCodec::decode( const char* data, size_t length, const ChunkRunCallback& blocks, const ChunkRunCallback& light )
+	{
+		EncodedHeader header;
+		if( length < sizeof( EncodedHeader ) || memcmp( data, ChunkMagic, sizeof( ChunkMagic ) ) != 0 )
+		{
+			if( length != LegacyLength ) return false;
+
+			// Raw arrays from before the codec, report them as runs anyway.
+			const char* ids = data;
+			const LightIndex* lights = (const LightIndex*)( data + CHUNK_SIZE * sizeof( uint32_t ) );
+			size_t start = 0;
+			uint32_t current, next;
+			memcpy( &current, ids, sizeof( uint32_t ) );
+			for( size_t i = 1; i <= CHUNK_SIZE; i++ )
+			{
+				if( i < CHUNK_SIZE ) memcpy( &next, ids + i * sizeof( uint32_t ), sizeof( uint32_t ) );
+				if( i == CHUNK_SIZE || next != current )
+				{
+					blocks( start, i - start, current );
+					start = i;
+					current = next;
+				}
+			}
+			start = 0;
+			for( size_t i = 1; i <= CHUNK_SIZE; i++ )
+			{
+				if( i == CHUNK_SIZE || lights[i] != lights[start] )
+				{
+					light( start, i - start, lights[start] );
+					start = i;
+				}
+			}
+			return true;
+		}
+
+		memcpy( &header, data, sizeof( EncodedHeader ) );
+		if( header.version > Version )
+		{
+			Util::log( "Chunk was saved by a newer version, ignoring it", Util::Warning );
+			return false;
+		}
+
+		// The length is trusted for the decompression buffer, so a corrupt
+		// one mustn't ask for gigabytes.
+		if( header.payloadLength > MaxPayloadLength ) return false;
+
+		const char* payload = data + sizeof( EncodedHeader );
+		const char* end = data + length;
+
+		std::vector<char> decompressed;
+		if( ( header.flags & CompressedLZ4 ) == CompressedLZ4 )
+		{
+#ifdef MAGNETITE_HAS_LZ4
+			decompressed.resize( header.payloadLength );
+			int read = LZ4_decompress_safe( payload, decompressed.data(), end - payload, decompressed.size() );
+			if( read < 0 || (size_t)read != decompressed.size() ) return false;
+			payload = decompressed.data();
+			end = payload + decompressed.size();
+#else
+			Util::log( "Chunk is LZ4 compressed but this build has no LZ4 support", Util::Error );
+			return false;
+#endif
+		}
+
+		switch( header.form )
+		{
+			case Empty:
+				blocks( 0, CHUNK_SIZE, 0 );
+				light( 0, CHUNK_SIZE, 0 );
+				return true;
+			case Uniform:
+			{
+				uint32_t id;
+				if( !readVarint( payload, end, id ) || payload >= end ) return false;
+				blocks( 0, CHUNK_SIZE, id );
+				light( 0, CHUNK_SIZE, (uint8_t)*payload );
+				return true;
+			}
+			case RunLength:
+				return readRuns( payload, end, false, blocks ) && readRuns( payload, end, true, light );
+		}
+
+		return false;
+	}
+};
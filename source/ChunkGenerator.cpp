@@ -5,10 +5,22 @@
 #include "BaseBlock.h"
 #include "World.h"
 
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define MAGNETITE_NOISE_SSE
+#include <emmintrin.h>
+#endif
+
 ChunkGenerator::ChunkGenerator(long seed)
 : mSeed( seed )
 {
 	srand(seed);
+	
+	// Powers of two, so folding in the 0.05 spacing doesn't change any sample.
+	for( int i = 0; i < HeightOctaves; i++ )
+	{
+		mOctaveScale[i] = pow( 2.f, (float)i ) * 0.05f;
+		mOctaveAmplitude[i] = pow( 0.25f, (float)i );
+	}
 }
 
 ChunkGenerator::~ChunkGenerator()
@@ -23,10 +35,18 @@ float ChunkGenerator::noise( long x, long z )
 	return ( 1.0f - ( (n * (n * n * 15731 + 789221) + 1376312589) & 0x7fffffff) / 1073741824.0f);
 }
 
-float ChunkGenerator::interpolateCosine( float a, float b, float x )
+/**
+ * Returns how far along a cosine curve from 0 to 1 the position x is.
+ */
+static inline float cosineWeight( float x )
 {
 	float ft = x * 3.1415827f;
-	ft = (1-cos(ft)) * .5f;
+	return (1-cos(ft)) * .5f;
+}
+
+float ChunkGenerator::interpolateCosine( float a, float b, float x )
+{
+	float ft = cosineWeight( x );
 	return (a*(1-ft) + b*ft);
 }
 
@@ -57,6 +77,174 @@ float ChunkGenerator::smooth( float x, float z )
 	return center + sides + corners;
 }
 
+/**
+ * The part of an octave's lattice that one axis of a grid of columns
+ * samples, with every coordinate in increasing order.
+ */
+struct NoiseAxis
+{
+	/**
+	 * Lower lattice cell of each column, as an index into lattice, and
+	 * the cosine weight towards the cell above it.
+	 */
+	int cell[CHUNK_WIDTH];
+	float weight[CHUNK_WIDTH];
+	
+	/**
+	 * Lattice coordinates used by any column.
+	 */
+	long lattice[2 * CHUNK_WIDTH];
+	int latticeCount;
+	
+	/**
+	 * Coordinates the noise is needed at to smooth the lattice, and the
+	 * index of the point before each lattice coordinate.
+	 */
+	long points[4 * CHUNK_WIDTH];
+	int pointCount;
+	int pointIndex[2 * CHUNK_WIDTH];
+	
+	void build( long start, float scale )
+	{
+		latticeCount = 0;
+		for( int a = 0; a < CHUNK_WIDTH; a++ )
+		{
+			float s = (float)( start + a ) * scale;
+			int c = s;
+			weight[a] = cosineWeight( s - c );
+			for( long l = c; l <= c + 1; l++ )
+			{
+				if( latticeCount == 0 || lattice[latticeCount - 1] < l ) lattice[latticeCount++] = l;
+			}
+			cell[a] = latticeCount - 2;
+		}
+		
+		pointCount = 0;
+		for( int l = 0; l < latticeCount; l++ )
+		{
+			for( long p = lattice[l] - 1; p <= lattice[l] + 1; p++ )
+			{
+				if( pointCount == 0 || points[pointCount - 1] < p ) points[pointCount++] = p;
+			}
+			pointIndex[l] = pointCount - 3;
+		}
+	}
+};
+
+#ifdef MAGNETITE_NOISE_SSE
+/**
+ * Multiplies 32 bit lanes keeping the low half of each, SSE2 can only
+ * multiply the even lanes at once.
+ */
+static inline __m128i mulLow( __m128i a, __m128i b )
+{
+	__m128i even = _mm_mul_epu32( a, b );
+	__m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+/**
+ * noise() at four x coordinates. Only the low 31 bits of the hash are
+ * kept, so 32 bit lanes give the same values as the long arithmetic.
+ */
+static inline __m128 noise4( __m128i x, long z )
+{
+	__m128i n = _mm_add_epi32( x, _mm_set1_epi32( z * 57 ) );
+	n = _mm_xor_si128( _mm_slli_epi32( n, 13 ), n );
+	__m128i h = _mm_add_epi32( mulLow( mulLow( n, n ), _mm_set1_epi32( 15731 ) ), _mm_set1_epi32( 789221 ) );
+	h = _mm_add_epi32( mulLow( n, h ), _mm_set1_epi32( 1376312589 ) );
+	h = _mm_and_si128( h, _mm_set1_epi32( 0x7fffffff ) );
+	return _mm_sub_ps( _mm_set1_ps( 1.0f ), _mm_div_ps( _mm_cvtepi32_ps( h ), _mm_set1_ps( 1073741824.0f ) ) );
+}
+#endif
+
+void ChunkGenerator::heightMap( long x, long z, float* heights )
+{
+	std::fill( heights, heights + CHUNK_WIDTH * CHUNK_WIDTH, 0.f );
+	
+	NoiseAxis ax, az;
+	std::vector<float> points, lattice;
+	for( int o = 0; o < HeightOctaves; o++ )
+	{
+		ax.build( x, mOctaveScale[o] );
+		az.build( z, mOctaveScale[o] );
+		
+		// Raw noise at every point the lattice is smoothed from.
+		points.resize( ax.pointCount * az.pointCount );
+		for( int pz = 0; pz < az.pointCount; pz++ )
+		{
+			float* row = &points[ pz * ax.pointCount ];
+			int px = 0;
+#ifdef MAGNETITE_NOISE_SSE
+			for( ; px + 4 <= ax.pointCount; px += 4 )
+			{
+				__m128i xs = _mm_setr_epi32( ax.points[px], ax.points[px + 1], ax.points[px + 2], ax.points[px + 3] );
+				_mm_storeu_ps( row + px, noise4( xs, az.points[pz] ) );
+			}
+#endif
+			for( ; px < ax.pointCount; px++ )
+			{
+				row[px] = noise( ax.points[px], az.points[pz] );
+			}
+		}
+		
+		// Smooth each lattice point once, summed in the same order as smooth().
+		lattice.resize( ax.latticeCount * az.latticeCount );
+		for( int lz = 0; lz < az.latticeCount; lz++ )
+		{
+			const float* r0 = &points[ az.pointIndex[lz] * ax.pointCount ];
+			const float* r1 = r0 + ax.pointCount;
+			const float* r2 = r1 + ax.pointCount;
+			for( int lx = 0; lx < ax.latticeCount; lx++ )
+			{
+				int i = ax.pointIndex[lx];
+				float corners = ( r0[i] + r0[i + 2] + r2[i] + r2[i + 2] ) / 16.f;
+				float sides = ( r1[i] + r1[i + 2] + r0[i + 1] + r2[i + 1] ) / 8.f;
+				float center = r1[i + 1] / 4.f;
+				lattice[ lz * ax.latticeCount + lx ] = center + sides + corners;
+			}
+		}
+		
+		// Blend the four cells around each column, as interpolatedNoise does.
+		float amp = mOctaveAmplitude[o];
+		for( int cz = 0; cz < CHUNK_WIDTH; cz++ )
+		{
+			const float* l0 = &lattice[ az.cell[cz] * ax.latticeCount ];
+			const float* l1 = l0 + ax.latticeCount;
+			float wz = az.weight[cz];
+			float* out = heights + cz * CHUNK_WIDTH;
+			int cx = 0;
+#ifdef MAGNETITE_NOISE_SSE
+			__m128 one = _mm_set1_ps( 1.f ), wz4 = _mm_set1_ps( wz ), amp4 = _mm_set1_ps( amp );
+			__m128 iz4 = _mm_sub_ps( one, wz4 );
+			for( ; cx + 4 <= CHUNK_WIDTH; cx += 4 )
+			{
+				const int* c = ax.cell + cx;
+				__m128 v1 = _mm_setr_ps( l0[c[0]], l0[c[1]], l0[c[2]], l0[c[3]] );
+				__m128 v2 = _mm_setr_ps( l0[c[0] + 1], l0[c[1] + 1], l0[c[2] + 1], l0[c[3] + 1] );
+				__m128 v3 = _mm_setr_ps( l1[c[0]], l1[c[1]], l1[c[2]], l1[c[3]] );
+				__m128 v4 = _mm_setr_ps( l1[c[0] + 1], l1[c[1] + 1], l1[c[2] + 1], l1[c[3] + 1] );
+				__m128 wx = _mm_loadu_ps( ax.weight + cx );
+				__m128 ix = _mm_sub_ps( one, wx );
+				
+				__m128 i1 = _mm_add_ps( _mm_mul_ps( v1, ix ), _mm_mul_ps( v2, wx ) );
+				__m128 i2 = _mm_add_ps( _mm_mul_ps( v3, ix ), _mm_mul_ps( v4, wx ) );
+				__m128 v = _mm_add_ps( _mm_mul_ps( i1, iz4 ), _mm_mul_ps( i2, wz4 ) );
+				_mm_storeu_ps( out + cx, _mm_add_ps( _mm_loadu_ps( out + cx ), _mm_mul_ps( v, amp4 ) ) );
+			}
+#endif
+			for( ; cx < CHUNK_WIDTH; cx++ )
+			{
+				int c = ax.cell[cx];
+				float wx = ax.weight[cx];
+				float i1 = l0[c] * ( 1 - wx ) + l0[c + 1] * wx;
+				float i2 = l1[c] * ( 1 - wx ) + l1[c + 1] * wx;
+				out[cx] = out[cx] + ( i1 * ( 1 - wz ) + i2 * wz ) * amp;
+			}
+		}
+	}
+}
+
 void ChunkGenerator::fillRegion( World* w, const Vector3& min, const Vector3& max )
 {
 	float p = 0.25f; 
@@ -105,9 +293,9 @@ void ChunkGenerator::fillRegion( World* w, const Vector3& min, const Vector3& ma
 
 void ChunkGenerator::fillChunk(Chunk *chunk)
 {
-	// Get the factories we need.
-	auto &sf = FactoryManager::getManager().blockFactoryList.find("stone")->second;
-	auto &gf = FactoryManager::getManager().blockFactoryList.find("grass")->second;
+	// Get the block types we need.
+	auto stone = FactoryManager::getManager().getBlockType("stone");
+	auto grass = FactoryManager::getManager().getBlockType("grass");
 	
 	ChunkScalar xsz = chunk->getX() * CHUNK_WIDTH + CHUNK_WIDTH;
 	ChunkScalar zsz = chunk->getZ() * CHUNK_WIDTH + CHUNK_WIDTH;
@@ -120,38 +308,32 @@ void ChunkGenerator::fillChunk(Chunk *chunk)
 		{
 			for( ChunkScalar y = chunk->getY()*CHUNK_WIDTH, yb = 0; y < ysz; y++, yb++ )
 			{
-				auto b = sf->create();
-				chunk->setBlockAt( b, xb, yb, zb);
+				chunk->setBlockAt( stone, xb, yb, zb);
 			}
 		}
 	}
 	
-	float octs = 8, p = 0.25f;
-
-	
 	ChunkScalar ys = std::max( chunk->getY() * CHUNK_HEIGHT, 98l );
 	ChunkScalar ye = chunk->getY() * CHUNK_HEIGHT + CHUNK_HEIGHT;
 	
 	if( chunk->getY() * CHUNK_HEIGHT > 128 + 30 ) return;
+	
+	float heights[CHUNK_WIDTH * CHUNK_WIDTH];
+	heightMap( chunk->getX() * CHUNK_WIDTH, chunk->getZ() * CHUNK_WIDTH, heights );
+	
 	for( ChunkScalar x = chunk->getX()*CHUNK_WIDTH, xb = 0; x < xsz; x++, xb++ )
 	{
 		for( ChunkScalar z = chunk->getZ()*CHUNK_WIDTH, zb = 0; z < zsz; z++, zb++ )
 		{
-			float total = 0.f;
-			for( float i = 0; i < octs; i++ ) {
-				float freq = pow(2.f, i);
-				float amp = pow(p, i);
-				total = total + interpolatedNoise((float)(x) * freq * 0.05f , (float)(z) *freq * 0.05f ) * amp;
-			}
-			total = std::floor((total*30.f) + 128.f);
+			float total = std::floor((heights[zb * CHUNK_WIDTH + xb]*30.f) + 128.f);
 			ChunkScalar yt = total;
 			
 			for( ChunkScalar y = ys, yb = ys % CHUNK_HEIGHT; y < ye; y++, yb++ )
 			{
 				if( y < yt-1 ) 
-					chunk->setBlockAt(sf->create(), xb, yb, zb );
+					chunk->setBlockAt(stone, xb, yb, zb );
 				else if( y < yt )
-					chunk->setBlockAt(gf->create(), xb, yb, zb ); 
+					chunk->setBlockAt(grass, xb, yb, zb ); 
 			}
 		}
 	}
@@ -0,0 +1,91 @@
+#include "ChunkNeighbourhood.h"
+#include "Chunk.h"
+#include "World.h"
+#include "BaseBlock.h"
+
+namespace Magnetite
+{
+	/**
+	 * Offset to the chunk on each face, in FACE_INDEX_ order.
+	 */
+	static const int neighbourDirections[FACE_COUNT][3] = {
+		{ 0, 1, 0 }, { 0, -1, 0 },
+		{ -1, 0, 0 }, { 1, 0, 0 },
+		{ 0, 0, -1 }, { 0, 0, 1 }
+	};
+
+	ChunkNeighbourhood::ChunkNeighbourhood()
+	: mBlocks( Width * Width * Width, NULL ),
+	mOpaque( Width * Width * Width, 0 ),
+	mLight( Width * Width * Width, 255 ),
+	mLoaded( 0 )
+	{
+	}
+
+	void ChunkNeighbourhood::_copy( Chunk* chunk, int dx, int dy, int dz, bool blocks )
+	{
+		// The positions a chunk covers along an axis: just the padding on
+		// either side, or the whole chunk for the middle.
+		const int d[3] = { dx, dy, dz };
+		long lo[3], hi[3];
+		for( int a = 0; a < 3; a++ )
+		{
+			lo[a] = d[a] < 0 ? -1 : ( d[a] > 0 ? CHUNK_WIDTH : 0 );
+			hi[a] = d[a] < 0 ? -1 : ( d[a] > 0 ? CHUNK_WIDTH : CHUNK_WIDTH - 1 );
+		}
+
+		for( long z = lo[2]; z <= hi[2]; z++ ) {
+			long sz = z - dz * CHUNK_WIDTH;
+			for( long y = lo[1]; y <= hi[1]; y++ ) {
+				long sy = y - dy * CHUNK_HEIGHT;
+				for( long x = lo[0]; x <= hi[0]; x++ ) {
+					long sx = x - dx * CHUNK_WIDTH;
+					size_t source = BLOCK_INDEX_2( sx, sy, sz );
+					size_t i = index( x, y, z );
+					BlockPtr block = chunk->getBlockAt( source );
+					if( blocks ) mBlocks[i] = block;
+					mOpaque[i] = block != NULL && block->isOpaque();
+					mLight[i] = chunk->getLightLevel( source );
+				}
+			}
+		}
+		mLoaded |= neighbourBit( dx, dy, dz );
+	}
+
+	bool ChunkNeighbourhood::gatherBorder( Chunk* chunk )
+	{
+		if( chunk->_hasChunkFlag( Chunk::Detached ) ) return true;
+
+		World* world = chunk->getWorld();
+		for( int dz = -1; dz <= 1; dz++ ) {
+			for( int dy = -1; dy <= 1; dy++ ) {
+				for( int dx = -1; dx <= 1; dx++ ) {
+					if( dx == 0 && dy == 0 && dz == 0 ) continue;
+
+					Chunk* neighbour = world->getChunk( chunk->getX() + dx, chunk->getY() + dy, chunk->getZ() + dz );
+					if( neighbour == nullptr ) continue;
+
+					if( !neighbour->getMutex().try_lock() ) return false;
+					gatherNeighbour( neighbour, dx, dy, dz );
+					neighbour->getMutex().unlock();
+				}
+			}
+		}
+		return true;
+	}
+
+	void ChunkNeighbourhood::gatherNeighbour( Chunk* neighbour, int dx, int dy, int dz )
+	{
+		_copy( neighbour, dx, dy, dz, false );
+	}
+
+	void ChunkNeighbourhood::gatherChunk( Chunk* chunk )
+	{
+		_copy( chunk, 0, 0, 0, true );
+	}
+
+	bool ChunkNeighbourhood::hasNeighbour( int face ) const
+	{
+		return ( mLoaded & neighbourBit( neighbourDirections[face][0], neighbourDirections[face][1], neighbourDirections[face][2] ) ) != 0;
+	}
+};
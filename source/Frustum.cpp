@@ -2,6 +2,11 @@
 #include "Camera.h"
 #include <glm/gtc/matrix_transform.hpp>
 
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#define MAGNETITE_FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
 float Plane::distance( const Vector3& p )
 {
 	return ( glm::dot( normal, p )  + d);
@@ -11,7 +16,8 @@ int Plane::getSide( const Vector3& center, const Vector3& halfSize )
 {
 	float dist = distance(center);
 
-	float maxDist = abs( glm::dot( normal, halfSize ) );
+	// How far the box reaches towards the plane from its center.
+	float maxDist = glm::dot( glm::abs( normal ), halfSize );
 	if( dist < -maxDist ) 
 		return NEGATIVE;
 	
@@ -78,17 +84,48 @@ void Frustum::updatePerspective()
 
 void Frustum::updatePlanes()
 {
-	Matrix4 view =  mCamera->getMatrix();
-	Matrix4 clip = getPerspective() * view;
+	if( mCamera == NULL ) return;
 	
-	// todo: this.
+	Matrix4 view = glm::inverse( mCamera->getMatrix() );
+	setPlanes( getPerspective() * view );
+}
 
+void Frustum::setPlanes( const Matrix4& clip )
+{
+	// Each plane is the last row of the matrix plus or minus one of the
+	// others, glm matrices are indexed by column.
+	Vector3 row[4];
+	float rowW[4];
+	for( int r = 0; r < 4; r++ )
+	{
+		row[r] = Vector3( clip[0][r], clip[1][r], clip[2][r] );
+		rowW[r] = clip[3][r];
+	}
+	
+	mPlanes[LEFT].normal = row[3] + row[0];
+	mPlanes[LEFT].d = rowW[3] + rowW[0];
+	mPlanes[RIGHT].normal = row[3] - row[0];
+	mPlanes[RIGHT].d = rowW[3] - rowW[0];
+	mPlanes[BOTTOM].normal = row[3] + row[1];
+	mPlanes[BOTTOM].d = rowW[3] + rowW[1];
+	mPlanes[TOP].normal = row[3] - row[1];
+	mPlanes[TOP].d = rowW[3] - rowW[1];
+	mPlanes[NEARP].normal = row[3] + row[2];
+	mPlanes[NEARP].d = rowW[3] + rowW[2];
+	mPlanes[FARP].normal = row[3] - row[2];
+	mPlanes[FARP].d = rowW[3] - rowW[2];
+	
+	for( int p = 0; p < 6; p++ )
+	{
+		float length = glm::length( mPlanes[p].normal );
+		mPlanes[p].normal = mPlanes[p].normal * ( 1.f / length );
+		mPlanes[p].d /= length;
+	}
 }
 
 int Frustum::intersectsAABB(const Vector3 &mins, const Vector3 &maxs)
 {
-	updatePlanes();
-	Vector3 halfSize = Vector3(maxs) - Vector3(mins);
+	Vector3 halfSize = ( Vector3(maxs) - Vector3(mins) ) * 0.5f;
 	Vector3 center = Vector3(mins) + halfSize;
 
 	/*if( Vector3(maxs) < Vector3(mins) ) {
@@ -114,6 +151,65 @@ int Frustum::intersectsAABB(const Vector3 &mins, const Vector3 &maxs)
 	return ret;
 }
 
+void Frustum::cullBoxes( const float* x, const float* y, const float* z, size_t count, const Vector3& halfSize, uint8_t* visible )
+{
+	// The boxes are all the same size, so how far they reach towards each
+	// plane can be folded into the plane's distance. A box is outside if
+	// its center is further than that behind any plane.
+	float nx[6], ny[6], nz[6], nd[6];
+	size_t planes = 0;
+	for( int p = 0; p < 6; p++ )
+	{
+		if( p == FARP && mFar == 0 )
+			continue; // Infinite view distance
+		
+		nx[planes] = mPlanes[p].normal.x;
+		ny[planes] = mPlanes[p].normal.y;
+		nz[planes] = mPlanes[p].normal.z;
+		nd[planes] = mPlanes[p].d + glm::dot( glm::abs( mPlanes[p].normal ), halfSize );
+		planes++;
+	}
+	
+	size_t i = 0;
+#ifdef MAGNETITE_FRUSTUM_SSE
+	__m128 zero = _mm_setzero_ps();
+	for( ; i + 4 <= count; i += 4 )
+	{
+		__m128 cx = _mm_loadu_ps( x + i );
+		__m128 cy = _mm_loadu_ps( y + i );
+		__m128 cz = _mm_loadu_ps( z + i );
+		
+		__m128 outside = zero;
+		for( size_t p = 0; p < planes; p++ )
+		{
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps( _mm_mul_ps( cx, _mm_set1_ps( nx[p] ) ), _mm_mul_ps( cy, _mm_set1_ps( ny[p] ) ) ),
+				_mm_add_ps( _mm_mul_ps( cz, _mm_set1_ps( nz[p] ) ), _mm_set1_ps( nd[p] ) ) );
+			outside = _mm_or_ps( outside, _mm_cmplt_ps( dist, zero ) );
+		}
+		
+		int mask = _mm_movemask_ps( outside );
+		visible[i] = ( mask & 1 ) == 0;
+		visible[i + 1] = ( mask & 2 ) == 0;
+		visible[i + 2] = ( mask & 4 ) == 0;
+		visible[i + 3] = ( mask & 8 ) == 0;
+	}
+#endif
+	
+	for( ; i < count; i++ )
+	{
+		visible[i] = 1;
+		for( size_t p = 0; p < planes; p++ )
+		{
+			if( x[i] * nx[p] + y[i] * ny[p] + z[i] * nz[p] + nd[p] < 0.f )
+			{
+				visible[i] = 0;
+				break;
+			}
+		}
+	}
+}
+
 void Frustum::updateFrustumVolume()
 {
 	/*if( mFrustumVolume )
@@ -0,0 +1,98 @@
+#include "JobPool.h"
+
+namespace Magnetite
+{
+	JobPool::JobPool( size_t threads )
+	: mRunning( false )
+	{
+		_start( threads );
+	}
+	
+	JobPool::~JobPool()
+	{
+		_stop();
+	}
+	
+	size_t JobPool::getDefaultThreadCount()
+	{
+		// Leave a core for the render and world threads.
+		size_t hw = std::thread::hardware_concurrency();
+		return hw > 2 ? hw - 1 : 1;
+	}
+	
+	void JobPool::_start( size_t threads )
+	{
+		if( threads == 0 ) threads = getDefaultThreadCount();
+		
+		mRunning = true;
+		for( size_t t = 0; t < threads; t++ )
+		{
+			mThreads.push_back( std::thread( &JobPool::_work, this ) );
+		}
+	}
+	
+	void JobPool::_stop()
+	{
+		mMutex.lock();
+		mRunning = false;
+		mMutex.unlock();
+		mCondition.notify_all();
+		
+		for( auto it = mThreads.begin(); it != mThreads.end(); ++it )
+		{
+			it->join();
+		}
+		mThreads.clear();
+	}
+	
+	void JobPool::_work()
+	{
+		while( true )
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock( mMutex );
+				while( mRunning && mJobs.empty() )
+				{
+					mCondition.wait( lock );
+				}
+				if( !mRunning ) return;
+				
+				job = mJobs.front();
+				mJobs.pop_front();
+			}
+			
+			job();
+		}
+	}
+	
+	void JobPool::setThreadCount( size_t threads )
+	{
+		if( threads == 0 ) threads = getDefaultThreadCount();
+		if( threads == mThreads.size() ) return;
+		
+		Util::log( "Job pool using " + Util::toString( threads ) + " threads" );
+		
+		_stop();
+		_start( threads );
+	}
+	
+	size_t JobPool::getThreadCount()
+	{
+		return mThreads.size();
+	}
+	
+	void JobPool::submit( const Job& job )
+	{
+		mMutex.lock();
+		mJobs.push_back( job );
+		mMutex.unlock();
+		mCondition.notify_one();
+	}
+	
+	size_t JobPool::getQueuedCount()
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		return mJobs.size();
+	}
+};
@@ -1,10 +1,7 @@
 #include "LightingManager.h"
-#include "MagnetiteCore.h"
 #include "BaseBlock.h"
 #include "World.h"
 #include "Chunk.h"
-#include "math.h"
-#include "Profiler.h"
 
 LightingManager::LightingManager()
 : litChunks(0)
@@ -15,247 +12,364 @@ LightingManager::~LightingManager()
 {
 }
 
-struct IntOffset {
-		float depth;
-		int x, y, z;
+/**
+ * Direction of each face, in FACE_INDEX_ order.
+ */
+static const int lightDirections[FACE_COUNT][3] = {
+	{ 0, 1, 0 }, { 0, -1, 0 },
+	{ -1, 0, 0 }, { 1, 0, 0 },
+	{ 0, 0, -1 }, { 0, 0, 1 }
 };
 
-#define point_count 16
-
-struct IntRay {
-	float left, right, top, bottom, front, back;
-	IntOffset points[point_count];
-};
-
-#define ray_count 6
+/**
+ * Returns true if light passes through the block.
+ */
+static inline bool isOpen( BaseBlock* block )
+{
+	return block == nullptr || !block->isOpaque();
+}
 
-struct Sample {
-	float left, right, top, bottom, front, back;
-	Sample() {
-		right = 0; left = 0; top = 0; bottom = 0; front = 0; back = 0;
-	}
-	float getSample( float right, float left, float top, float bottom, float front, float back) {
-		float t = 0;
-		t += ( right / this->right );
-		t += ( left / this->left );
-		t += ( top / this->top );
-		t += ( bottom / this->bottom );
-		t += ( front / this->front );
-		t += ( back / this->back );
-		t /= 6;
-		return t;
-	}
-};
+/**
+ * Returns the light a block passes on to its neighbour in a direction.
+ */
+static inline LightIndex passedLight( LightIndex light, int face )
+{
+	if( face == FACE_INDEX_BOTTOM && light == LightingManager::Sunlight ) return light;
+	return light > LightingManager::LightFalloff ? light - LightingManager::LightFalloff : 0;
+}
 
-void LightingManager::gatherLight( Chunk* chunk )
+int LightingManager::lightChunk( Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood )
 {
-	BaseBlock* block = NULL;
-	static Sample smp;
-	static IntRay rays[ray_count];
-	static bool madeRays = false;
-	World* world = MagnetiteCore::Singleton->getWorld();
-
-	if( !madeRays ) {
-		// Generate some useful rays.
-		int n = ray_count;
-		Vector3 pts[ray_count];
-		float inc = 3.141f * ( 3 - sqrt( 5.f ) );
-		float off = 2 / (float)n;
-		for( int k = 0; k < n; k++ ) {
-			float y = k * off - 1 + (off / 2);
-			float r = sqrt( 1 - y*y );
-			float phi = k * inc;
-			pts[k].x = cos(phi)*r;
-			pts[k].y = y;
-			pts[k].z = sin(phi)*r;
-		}
+	std::vector<LightIndex> light( CHUNK_SIZE, 0 );
+	std::vector<uint16_t> queue;
+	queue.reserve( CHUNK_SIZE );
 
-		for( int i = 0; i < ray_count; i++ ) {
-			IntRay current;
-
-			float sx = pts[i].x * 0.2f;
-			float sy = pts[i].y * 0.2f;
-			float sz = pts[i].z * 0.2f;
-
-			float x = 0, y = 0, z = 0;
-
-			int cx = 0, cy = 0, cz = 0;
-
-			int p = 0;
-			while( p < point_count ) {
-				int nx = x;
-				int ny = y;
-				int nz = z;
-				if( nx != cx || ny != cy || nz != cz ) {
-					current.points[p].depth = sqrt( x*x + y*y + z*z );
-					current.points[p].x = nx;
-					current.points[p].y = ny;
-					current.points[p].z = nz;
-					cx = nx;
-					cy = ny;
-					cz = nz;
-					p++;
-				}
-				x += sx;
-				y += sy;
-				z += sz;
+	// Sunlight falls down each column until something stops it, nothing
+	// loaded above means open sky.
+	bool sky = !hood.hasNeighbour( FACE_INDEX_TOP );
+	for( long z = 0; z < CHUNK_WIDTH; z++ ) {
+		for( long x = 0; x < CHUNK_WIDTH; x++ ) {
+			if( !sky && hood.getLight( x, CHUNK_HEIGHT, z ) != Sunlight ) continue;
+			for( long y = CHUNK_HEIGHT - 1; y >= 0; y-- ) {
+				if( hood.isOpaque( x, y, z ) ) break;
+				size_t i = BLOCK_INDEX_2( x, y, z );
+				light[i] = Sunlight;
+				queue.push_back( i );
 			}
-
-			current.right	= ( pts[i].x < 0 ? -pts[i].x : 0 );
-			current.left	= ( pts[i].x > 0 ? pts[i].x : 0 );
-			current.top		= ( pts[i].y < 0 ? -pts[i].y : 0 );
-			current.bottom	= ( pts[i].y > 0 ? pts[i].y : 0 );
-			current.front	= ( pts[i].z < 0 ? -pts[i].z : 0 );
-			current.back	= ( pts[i].z > 0 ? pts[i].z : 0 );
-
-			smp.right += current.right;
-			smp.left += current.left;
-			smp.top += current.top;
-			smp.bottom += current.bottom;
-			smp.front += current.front;
-			smp.back += current.back;
-
-			rays[i] = current;
 		}
-		madeRays = true;
 	}
 
-	IntRay *ray, *rayend;
-	IntOffset *offs, *offend;
-	BaseBlock* obs = NULL;
-	long pX = (chunk->getX() * CHUNK_WIDTH);
-	long pY = (chunk->getY() * CHUNK_HEIGHT);
-	long pZ = (chunk->getZ() * CHUNK_WIDTH);
-	
-	if( chunk->getBlockCount() > 0 && chunk->getBlockCount() < CHUNK_SIZE )
+	// Take in the light of the blocks just outside each face.
+	for( int f = 0; f < FACE_COUNT; f++ )
 	{
-		float right = 0, left = 0, top = 0, bottom = 0, front = 0, back = 0;
-		for( short x = 0; x < CHUNK_WIDTH; x++ ) {
-			for( short y = 0; y < CHUNK_HEIGHT; y++ ) {
-				for( short z = 0; z < CHUNK_WIDTH; z++ ) {
-					block = chunk->getBlockAt( x, y, z );
-					if( block == NULL && chunk->hasNeighbours( x, y, z ) ) {
-						long wx = x + pX;
-						long wy = y + pY;
-						long wz = z + pZ;
-						right = 0; left = 0; top = 0; bottom = 0; front = 0; back = 0;
-						for( ray = &rays[0], rayend = &rays[0 + ray_count]; ray < rayend; ray++ ) {
-							for( offs = &ray->points[0], offend = &ray->points[0 + point_count]; offs < offend; offs++ ) {
-								obs = world->getBlockAt( wx + offs->x, wy + offs->y, wz + offs->z );
-								if( obs ) break;
-							}
-							if( obs == nullptr )
-							{
-								right += ray->right;
-								left += ray->left;
-								top += ray->top;
-								bottom += ray->bottom;
-								front += ray->front;
-								back += ray->back;
-							}
-						}
-						LightIndex lighness = std::min(smp.getSample(right, left, top, bottom, front, back) * 255.f * 2.f, 255.f);
-						chunk->setLightLevel( lighness, x, y, z);
-					}
+		if( !hood.hasNeighbour( f ) ) continue;
+
+		int axis = lightDirections[f][0] != 0 ? 0 : ( lightDirections[f][1] != 0 ? 1 : 2 );
+		bool positive = lightDirections[f][axis] > 0;
+		long p[3];
+		p[axis] = positive ? CHUNK_WIDTH - 1 : 0;
+		int uAxis = ( axis + 1 ) % 3, vAxis = ( axis + 2 ) % 3;
+		for( p[vAxis] = 0; p[vAxis] < CHUNK_WIDTH; p[vAxis]++ ) {
+			for( p[uAxis] = 0; p[uAxis] < CHUNK_WIDTH; p[uAxis]++ ) {
+				if( hood.isOpaque( p[0], p[1], p[2] ) ) continue;
+
+				LightIndex l = passedLight( hood.getLight( p[0] + lightDirections[f][0], p[1] + lightDirections[f][1], p[2] + lightDirections[f][2] ), f ^ 1 );
+				size_t i = BLOCK_INDEX_2( p[0], p[1], p[2] );
+				if( light[i] < l )
+				{
+					light[i] = l;
+					queue.push_back( i );
 				}
 			}
 		}
 	}
-	
-}
 
-void LightingManager::lightChunk( Chunk* chunk )
-{
-	/*for( size_t x = 0; x < CHUNK_WIDTH; x++ ) 
+	// Flood out from every lit block, a block is queued again whenever it
+	// gets brighter.
+	for( size_t head = 0; head < queue.size(); head++ )
 	{
-		for( size_t z = 0; z < CHUNK_WIDTH; z++ ) 
+		size_t i = queue[head];
+		if( light[i] <= LightFalloff ) continue;
+
+		long p[3] = { (long)( i % CHUNK_WIDTH ), (long)( ( i / CHUNK_WIDTH ) % CHUNK_HEIGHT ), (long)( i / ( CHUNK_WIDTH * CHUNK_HEIGHT ) ) };
+		for( int f = 0; f < FACE_COUNT; f++ )
 		{
-			lightColumn( chunk, x,  z, WorldChunk::Sunlight );
+			long n[3] = { p[0] + lightDirections[f][0], p[1] + lightDirections[f][1], p[2] + lightDirections[f][2] };
+			if( n[0] < 0 || n[1] < 0 || n[2] < 0 || n[0] >= CHUNK_WIDTH || n[1] >= CHUNK_HEIGHT || n[2] >= CHUNK_WIDTH ) continue;
+			if( hood.isOpaque( n[0], n[1], n[2] ) ) continue;
+
+			size_t ni = BLOCK_INDEX_2( n[0], n[1], n[2] );
+			LightIndex l = passedLight( light[i], f );
+			if( light[ni] < l )
+			{
+				light[ni] = l;
+				queue.push_back( ni );
+			}
 		}
-	}*/
-	gatherLight( chunk );
+	}
+
+	int faces = 0;
+	for( size_t i = 0; i < CHUNK_SIZE; i++ )
+	{
+		if( chunk->getLightLevel( i ) == light[i] ) continue;
+		chunk->setLightLevel( light[i], i );
+
+		long x = i % CHUNK_WIDTH, y = ( i / CHUNK_WIDTH ) % CHUNK_HEIGHT, z = i / ( CHUNK_WIDTH * CHUNK_HEIGHT );
+		if( x == 0 ) faces |= 1 << FACE_INDEX_LEFT;
+		if( x == CHUNK_WIDTH - 1 ) faces |= 1 << FACE_INDEX_RIGHT;
+		if( y == 0 ) faces |= 1 << FACE_INDEX_BOTTOM;
+		if( y == CHUNK_HEIGHT - 1 ) faces |= 1 << FACE_INDEX_TOP;
+		if( z == 0 ) faces |= 1 << FACE_INDEX_FORWARD;
+		if( z == CHUNK_WIDTH - 1 ) faces |= 1 << FACE_INDEX_BACK;
+	}
+	return faces;
 }
-/*
-void LightingManager::lightColumn( Chunk* chunk, size_t x, size_t z, LightIndex light )
+
+/**
+ * Light at a block position for the incremental updates.
+ */
+struct LightNode
 {
-	LightIndex currentLight = WorldChunk::Sunlight;
-	char directionFlags = 0; // Stores directions in which take us under cover.
-	bool oh_my_its_dark_in_here = false; // Have we gone under-cover
-	for( short y = CHUNK_HEIGHT - 1; y >= 0; y-- )
+	long x, y, z;
+	LightIndex light;
+};
+
+/**
+ * Finds blocks by world position for the incremental updates, keeping the
+ * last chunk as most steps stay inside it. Light is written to copies of
+ * the chunks' light, which apply copies back once the update is done.
+ */
+class LightCache
+{
+	/**
+	 * The new light of a chunk and the blocks written in it.
+	 */
+	struct Written
 	{
-		if( chunk->getBlockAt(x, y, z) ) 
+		Chunk* chunk;
+		std::vector<LightIndex> light;
+		std::vector<uint16_t> indices;
+	};
+
+	World* mWorld;
+	Chunk* mChunk;
+	long mX, mY, mZ;
+	std::vector<Written> mWritten;
+
+	Written* _find( Chunk* chunk )
+	{
+		for( size_t w = 0; w < mWritten.size(); w++ )
 		{
-			chunk->setLightLevel( x, y, z, 0 );
-			oh_my_its_dark_in_here = true;
+			if( mWritten[w].chunk == chunk ) return &mWritten[w];
 		}
-		else if( !oh_my_its_dark_in_here )
+		return nullptr;
+	}
+
+	void _changed( std::vector<Chunk*>& changed, Chunk* chunk )
+	{
+		if( chunk != nullptr && std::find( changed.begin(), changed.end(), chunk ) == changed.end() )
 		{
-			// Sunlight
-			chunk->setLightLevel( x, y, z, WorldChunk::Sunlight );
+			changed.push_back( chunk );
 		}
-		else
+	}
+
+public:
+	LightCache( World* world )
+	: mWorld( world ), mChunk( nullptr ), mX( -1 ), mY( -1 ), mZ( -1 )
+	{
+	}
+
+	/**
+	 * Returns the chunk holding the position and sets the block's index
+	 * in it, or returns NULL if no chunk is loaded there.
+	 */
+	Chunk* find( long x, long y, long z, size_t& index )
+	{
+		if( x < 0 || y < 0 || z < 0 ) return nullptr;
+		long cx = x / CHUNK_WIDTH, cy = y / CHUNK_HEIGHT, cz = z / CHUNK_WIDTH;
+		if( cx != mX || cy != mY || cz != mZ )
 		{
-			chunk->setLightLevel( x, y, z, 0 );
+			mChunk = mWorld->getChunk( cx, cy, cz );
+			mX = cx; mY = cy; mZ = cz;
 		}
+		long lx = x % CHUNK_WIDTH, ly = y % CHUNK_HEIGHT, lz = z % CHUNK_WIDTH;
+		index = BLOCK_INDEX_2( lx, ly, lz );
+		return mChunk;
+	}
 
-		if( !oh_my_its_dark_in_here ) {
-			//Check -X 
-			if( chunk->getBlockAt(x - 1, y, z) )
-			{
-				directionFlags |= NEG_X;
-			}
-			else if( (directionFlags & NEG_X) == NEG_X )
+	LightIndex get( Chunk* chunk, size_t index )
+	{
+		Written* written = _find( chunk );
+		return written != nullptr ? written->light[index] : chunk->getLightLevel( index );
+	}
+
+	void set( Chunk* chunk, size_t index, LightIndex light )
+	{
+		Written* written = _find( chunk );
+		if( written == nullptr )
+		{
+			mWritten.push_back( Written() );
+			written = &mWritten.back();
+			written->chunk = chunk;
+			written->light.resize( CHUNK_SIZE );
+			for( size_t i = 0; i < CHUNK_SIZE; i++ )
 			{
-				// light shadow
-				lightUnderground( chunk, x - 1, y, z, NEG_X, WorldChunk::Sunlight | 1 );
+				written->light[i] = chunk->getLightLevel( i );
 			}
+		}
+		written->light[index] = light;
+		written->indices.push_back( index );
+	}
 
-			//Check +X 
-			if( chunk->getBlockAt(x+1, y, z) )
+	/**
+	 * Writes the new light into the chunks. Mesh workers read a chunk's
+	 * light while they hold its lock, so nothing is written unless every
+	 * chunk can be locked and none of them is being meshed.
+	 * @param changed Chunks whose light changed, or whose faces are lit by
+	 * a changed block across their edge, are added to this
+	 * @return false if a chunk was busy, nothing is written then.
+	 */
+	bool apply( std::vector<Chunk*>& changed )
+	{
+		size_t locked = 0;
+		for( ; locked < mWritten.size(); locked++ )
+		{
+			Chunk* chunk = mWritten[locked].chunk;
+			// Meshing only starts on this thread, so it can't start after the check.
+			if( chunk->isMeshing() || !chunk->getMutex().try_lock() ) break;
+		}
+		if( locked < mWritten.size() )
+		{
+			for( size_t w = 0; w < locked; w++ )
 			{
-				directionFlags |= POS_X;
+				mWritten[w].chunk->getMutex().unlock();
 			}
-			else if( (directionFlags & POS_X) == POS_X )
+			return false;
+		}
+
+		for( size_t w = 0; w < mWritten.size(); w++ )
+		{
+			Written& written = mWritten[w];
+			Chunk* chunk = written.chunk;
+			for( size_t i = 0; i < written.indices.size(); i++ )
 			{
-				// light shadow
-				lightUnderground( chunk, x + 1, y, z, POS_X, WorldChunk::Sunlight | 1 );
+				size_t index = written.indices[i];
+				chunk->setLightLevel( written.light[index], index );
 			}
+			chunk->getMutex().unlock();
+			_changed( changed, chunk );
 
-			//Check -Z
-			if( chunk->getBlockAt(x, y, z-1) )
+			// Faces in the chunk across an edge are lit by the blocks on it.
+			for( size_t i = 0; i < written.indices.size(); i++ )
 			{
-				directionFlags |= NEG_Z;
+				size_t index = written.indices[i];
+				long lx = index % CHUNK_WIDTH, ly = ( index / CHUNK_WIDTH ) % CHUNK_HEIGHT, lz = index / ( CHUNK_WIDTH * CHUNK_HEIGHT );
+				if( lx == 0 ) _changed( changed, mWorld->getChunk( chunk->getX() - 1, chunk->getY(), chunk->getZ() ) );
+				if( lx == CHUNK_WIDTH - 1 ) _changed( changed, mWorld->getChunk( chunk->getX() + 1, chunk->getY(), chunk->getZ() ) );
+				if( ly == 0 ) _changed( changed, mWorld->getChunk( chunk->getX(), chunk->getY() - 1, chunk->getZ() ) );
+				if( ly == CHUNK_HEIGHT - 1 ) _changed( changed, mWorld->getChunk( chunk->getX(), chunk->getY() + 1, chunk->getZ() ) );
+				if( lz == 0 ) _changed( changed, mWorld->getChunk( chunk->getX(), chunk->getY(), chunk->getZ() - 1 ) );
+				if( lz == CHUNK_WIDTH - 1 ) _changed( changed, mWorld->getChunk( chunk->getX(), chunk->getY(), chunk->getZ() + 1 ) );
 			}
-			else if( (directionFlags & NEG_Z) == NEG_Z )
+		}
+		return true;
+	}
+};
+
+bool LightingManager::updateBlock( World* world, long x, long y, long z, std::vector<Chunk*>& changed )
+{
+	LightCache cache( world );
+	std::vector<LightNode> darken, spread;
+
+	size_t index;
+	Chunk* chunk = cache.find( x, y, z, index );
+	if( chunk == nullptr ) return true;
+
+	if( !isOpen( chunk->getBlockAt( index ) ) )
+	{
+		// The block now stops light, take away everything that came through it.
+		LightIndex old = cache.get( chunk, index );
+		if( old > 0 )
+		{
+			cache.set( chunk, index, 0 );
+			darken.push_back( LightNode{ x, y, z, old } );
+		}
+	}
+	else
+	{
+		// Let the light around the block back in.
+		for( int f = 0; f < FACE_COUNT; f++ )
+		{
+			long nx = x + lightDirections[f][0], ny = y + lightDirections[f][1], nz = z + lightDirections[f][2];
+			size_t ni;
+			Chunk* c = cache.find( nx, ny, nz, ni );
+			if( c == nullptr )
 			{
-				// light shadow
-				lightUnderground( chunk, x, y, z - 1, NEG_Z, WorldChunk::Sunlight | 1 );
+				// Nothing loaded above is open sky.
+				if( f == FACE_INDEX_TOP )
+				{
+					cache.set( chunk, index, Sunlight );
+					spread.push_back( LightNode{ x, y, z, Sunlight } );
+				}
+				continue;
 			}
+			LightIndex l = cache.get( c, ni );
+			if( l > 0 ) spread.push_back( LightNode{ nx, ny, nz, l } );
+		}
+	}
+
+	// Clear the light that came from darkened blocks, anything brighter
+	// found on the way is lit from elsewhere and spreads back in.
+	for( size_t head = 0; head < darken.size(); head++ )
+	{
+		LightNode node = darken[head];
+		for( int f = 0; f < FACE_COUNT; f++ )
+		{
+			long nx = node.x + lightDirections[f][0], ny = node.y + lightDirections[f][1], nz = node.z + lightDirections[f][2];
+			size_t ni;
+			Chunk* c = cache.find( nx, ny, nz, ni );
+			if( c == nullptr ) continue;
 
-			//Check +Z 
-			if( chunk->getBlockAt(x, y, z+1) )
+			LightIndex l = cache.get( c, ni );
+			if( l == 0 ) continue;
+
+			if( l < node.light || ( f == FACE_INDEX_BOTTOM && node.light == Sunlight ) )
 			{
-				directionFlags |= POS_Z;
+				cache.set( c, ni, 0 );
+				darken.push_back( LightNode{ nx, ny, nz, l } );
 			}
-			else if( (directionFlags & POS_Z) == POS_Z )
+			else
 			{
-				// light shadow
-				lightUnderground( chunk, x, y, z + 1, POS_Z, WorldChunk::Sunlight | 1 );
+				spread.push_back( LightNode{ nx, ny, nz, l } );
 			}
 		}
 	}
-}
 
-void LightingManager::lightUnderground( Chunk* chunk, size_t x, size_t startY, size_t z, size_t dir, LightIndex light )
-{
-	LightIndex currentLight = light;
-	for( short y = startY; y >= 0; y-- )
+	for( size_t head = 0; head < spread.size(); head++ )
 	{
-		// if we hit a block, stop
-		if( chunk->getBlockAt( x, y, z ) )
-			return;
-		// Set the light level 
-		chunk->setLightLevel( x, y, z, currentLight );
+		LightNode node = spread[head];
+		size_t i;
+		Chunk* from = cache.find( node.x, node.y, node.z, i );
+
+		// The block may have been darkened or brightened since it was queued.
+		LightIndex light = cache.get( from, i );
+		if( light <= LightFalloff ) continue;
+
+		for( int f = 0; f < FACE_COUNT; f++ )
+		{
+			long nx = node.x + lightDirections[f][0], ny = node.y + lightDirections[f][1], nz = node.z + lightDirections[f][2];
+			size_t ni;
+			Chunk* c = cache.find( nx, ny, nz, ni );
+			if( c == nullptr || !isOpen( c->getBlockAt( ni ) ) ) continue;
+
+			LightIndex l = passedLight( light, f );
+			if( cache.get( c, ni ) < l )
+			{
+				cache.set( c, ni, l );
+				spread.push_back( LightNode{ nx, ny, nz, l } );
+			}
+		}
 	}
+
+	return cache.apply( changed );
 }
-*/
\ No newline at end of file
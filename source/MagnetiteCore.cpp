@@ -11,6 +11,7 @@
 #include "ScriptGame.h"
 #include "BulletDebug.h"
 #include "ResourceManager.h"
+#include "GreedyTriangulator.h"
 #include <BaseEntity.h>
 #include <Components/InfoComponent.h>
 #include <Components/PhysicsComponent.h>
@@ -44,6 +45,8 @@ mWorld( NULL ),
 mGame( NULL ),
 mContinue( true ),
 mTimescale( 1.f ),
+mWorkerCount( 0 ),
+mGreedyMeshing( false ),
 mPBroadphase( NULL ),
 mPCConfig( NULL ),
 mCCDispatch ( NULL ),
@@ -106,6 +109,14 @@ void MagnetiteCore::init(int argc, char **argv)
 		{
 			height = atoi(argv[i+1]);
 		}
+		if( HASARG("--workers", "-j" ) &&  i + 1 < argc )
+		{
+			mWorkerCount = atoi(argv[i+1]);
+		}
+		if( HASARG("--greedy", "-g" ) )
+		{
+			mGreedyMeshing = true;
+		}
 	}
 	
 	glewInit();
@@ -332,6 +343,10 @@ void MagnetiteCore::go()
 				(lEvt.key.code == sf::Keyboard::F7 ) ) {
 				mRenderer->setDebugMode( Renderer::DEBUG_PERF );
 			}
+			if( (lEvt.type == sf::Event::KeyReleased ) &&
+				(lEvt.key.code == sf::Keyboard::F8 ) ) {
+				mRenderer->setOcclusionCulling( !mRenderer->isOcclusionCulling() );
+			}
 			if( (lEvt.type == sf::Event::KeyPressed) &&
 				(lEvt.key.code == sf::Keyboard::Num9) ) {
 					mTimescale *= 0.5f;
@@ -445,6 +460,11 @@ void MagnetiteCore::newWorld( std::string name )
 
 	mWorld = new World( 5 );
 	mWorld->setName(name);
+	mWorld->setWorkerCount( mWorkerCount );
+	if( mGreedyMeshing )
+	{
+		mWorld->setTriangulator( new GreedyTriangulator() );
+	}
 }
 
 void MagnetiteCore::unloadWorld()
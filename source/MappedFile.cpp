@@ -0,0 +1,86 @@
+#include "MappedFile.h"
+
+#ifdef WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Magnetite
+{
+	MappedFile::MappedFile()
+	: mData( nullptr ),
+	mSize( 0 )
+	{
+	}
+	
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+	
+	bool MappedFile::open( const String& path )
+	{
+		close();
+		
+#ifdef WIN32
+		std::ifstream stream( path.c_str(), std::ios::binary );
+		if( !stream.is_open() ) return false;
+		mBuffer.assign( std::istreambuf_iterator<char>( stream ), std::istreambuf_iterator<char>() );
+		if( mBuffer.empty() ) return false;
+		mData = mBuffer.data();
+		mSize = mBuffer.size();
+#else
+		int fd = ::open( path.c_str(), O_RDONLY );
+		if( fd < 0 ) return false;
+		
+		struct stat info;
+		if( fstat( fd, &info ) != 0 || info.st_size == 0 )
+		{
+			::close( fd );
+			return false;
+		}
+		
+		// The mapping keeps the file alive, the descriptor isn't needed.
+		void* data = mmap( nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+		::close( fd );
+		if( data == MAP_FAILED ) return false;
+		
+		mData = (const char*)data;
+		mSize = info.st_size;
+#endif
+		return true;
+	}
+	
+	void MappedFile::close()
+	{
+		if( mData == nullptr ) return;
+		
+#ifdef WIN32
+		mBuffer.clear();
+#else
+		munmap( (void*)mData, mSize );
+#endif
+		mData = nullptr;
+		mSize = 0;
+	}
+	
+	bool MappedFile::isOpen() const
+	{
+		return mData != nullptr;
+	}
+	
+	const char* MappedFile::getData() const
+	{
+		return mData;
+	}
+	
+	size_t MappedFile::getSize() const
+	{
+		return mSize;
+	}
+};
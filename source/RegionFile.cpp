@@ -0,0 +1,316 @@
+#include "RegionFile.h"
+#include <algorithm>
+#include <cstddef>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+namespace Magnetite
+{
+	/**
+	 * Don't bother compacting until at least this many sectors are wasted.
+	 */
+	static const size_t MinCompactSectors = 16;
+
+	static const char RegionMagic[4] = { 'M', 'G', 'R', 'F' };
+
+	RegionFile::RegionFile()
+	: mReaders( 0 )
+	{
+		memset( &mHeader, 0, sizeof( Header ) );
+	}
+
+	RegionFile::~RegionFile()
+	{
+		mMap.reset();
+		if( mFile.is_open() )
+		{
+			mFile.close();
+		}
+	}
+
+	size_t RegionFile::chunkIndex( ChunkScalar x, ChunkScalar y, ChunkScalar z )
+	{
+		x %= REGION_SIZE; y %= REGION_SIZE; z %= REGION_SIZE;
+		return z * REGION_SIZE * REGION_SIZE + y * REGION_SIZE + x;
+	}
+
+	size_t RegionFile::_sectorsFor( size_t bytes )
+	{
+		return ( bytes + SectorSize - 1 ) / SectorSize;
+	}
+
+	bool RegionFile::open( const String& path, bool create )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mPath = path;
+
+		mFile.open( path.c_str(), std::ios::in | std::ios::out | std::ios::binary );
+		if( !mFile.is_open() )
+		{
+			if( !create ) return false;
+
+			// fstream won't create a file opened for reading, so make it first.
+			mFile.open( path.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+			if( !mFile.is_open() ) return false;
+
+			memset( &mHeader, 0, sizeof( Header ) );
+			memcpy( mHeader.magic, RegionMagic, sizeof( RegionMagic ) );
+			mHeader.version = Version;
+			mFile.write( (char*)&mHeader, sizeof( Header ) );
+			mFile.flush();
+		}
+		else
+		{
+			mFile.read( (char*)&mHeader, sizeof( Header ) );
+			if( !mFile || memcmp( mHeader.magic, RegionMagic, sizeof( RegionMagic ) ) != 0 || mHeader.version > Version )
+			{
+				Util::log( "Invalid region file: " + path, Util::Error );
+				mFile.close();
+				return false;
+			}
+		}
+
+		// Rebuild the sector map from the header.
+		mUsedSectors.assign( HeaderSectors, true );
+		for( size_t i = 0; i < ChunkCount; i++ )
+		{
+			const Entry& e = mHeader.entries[i];
+			if( e.sector == 0 ) continue;
+			size_t end = e.sector + _sectorsFor( e.length );
+			if( mUsedSectors.size() < end ) mUsedSectors.resize( end, false );
+			std::fill( mUsedSectors.begin() + e.sector, mUsedSectors.begin() + end, true );
+		}
+
+		return true;
+	}
+
+	bool RegionFile::hasChunk( size_t index )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		return index < ChunkCount && mHeader.entries[index].sector != 0;
+	}
+
+	bool RegionFile::readChunk( size_t index, const ChunkReader& reader )
+	{
+		std::shared_ptr<MappedFile> map;
+		size_t offset, length;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			if( index >= ChunkCount ) return false;
+			
+			const Entry& e = mHeader.entries[index];
+			if( e.sector == 0 ) return false;
+			
+			// Writes go through the page cache too, so the view only needs
+			// replacing when the file has grown past it.
+			offset = (size_t)e.sector * SectorSize;
+			length = e.length;
+			if( !mMap || mMap->getSize() < offset + length )
+			{
+				std::shared_ptr<MappedFile> view( new MappedFile() );
+				if( !view->open( mPath ) || view->getSize() < offset + length ) return false;
+				mMap = view;
+			}
+			map = mMap;
+			mReaders++;
+		}
+		
+		bool read = reader( map->getData() + offset, length );
+		
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mReaders--;
+		}
+		mReadersDone.notify_all();
+		return read;
+	}
+	
+	bool RegionFile::readChunk( size_t index, std::vector<char>& data )
+	{
+		return readChunk( index, [&data]( const char* chunk, size_t length ) {
+			data.assign( chunk, chunk + length );
+			return true;
+		} );
+	}
+	
+	uint32_t RegionFile::_allocate( size_t sectors )
+	{
+		// First fit, the table is small enough that a linear scan is fine.
+		size_t run = 0;
+		for( size_t s = HeaderSectors; s < mUsedSectors.size(); s++ )
+		{
+			run = mUsedSectors[s] ? 0 : run + 1;
+			if( run == sectors )
+			{
+				size_t start = s + 1 - sectors;
+				std::fill( mUsedSectors.begin() + start, mUsedSectors.begin() + start + sectors, true );
+				return start;
+			}
+		}
+
+		// Nothing free, grow the file. A free run at the end is reused.
+		size_t start = mUsedSectors.size() - run;
+		mUsedSectors.resize( start + sectors, true );
+		std::fill( mUsedSectors.begin() + start, mUsedSectors.end(), true );
+		return start;
+	}
+
+	void RegionFile::_release( uint32_t sector, size_t sectors )
+	{
+		std::fill( mUsedSectors.begin() + sector, mUsedSectors.begin() + sector + sectors, false );
+		while( mUsedSectors.size() > HeaderSectors && !mUsedSectors.back() )
+		{
+			mUsedSectors.pop_back();
+		}
+	}
+
+	void RegionFile::_writeEntry( size_t index )
+	{
+		mFile.clear();
+		mFile.seekp( offsetof( Header, entries ) + index * sizeof( Entry ) );
+		mFile.write( (char*)&mHeader.entries[index], sizeof( Entry ) );
+	}
+
+	bool RegionFile::writeChunk( size_t index, const char* data, size_t length )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		if( index >= ChunkCount || length == 0 || !mFile.is_open() ) return false;
+
+		Entry& e = mHeader.entries[index];
+		size_t sectors = _sectorsFor( length );
+		size_t oldSectors = e.sector != 0 ? _sectorsFor( e.length ) : 0;
+
+		if( e.sector != 0 && sectors <= oldSectors )
+		{
+			// Still fits, write in place and give back what's left over.
+			if( sectors < oldSectors )
+			{
+				_release( e.sector + sectors, oldSectors - sectors );
+			}
+		}
+		else
+		{
+			if( e.sector != 0 )
+			{
+				_release( e.sector, oldSectors );
+			}
+			e.sector = _allocate( sectors );
+		}
+		e.length = length;
+
+		mFile.clear();
+		mFile.seekp( (std::streamoff)e.sector * SectorSize );
+		mFile.write( data, length );
+		_writeEntry( index );
+		mFile.flush();
+#ifdef WIN32
+		// The fallback view is a copy, it won't see this write.
+		mMap.reset();
+#endif
+
+		// Chunks being read can't be moved, a later write compacts instead.
+		if( mReaders == 0 && _getWastedSectors() >= std::max( MinCompactSectors, mUsedSectors.size() / 2 ) )
+		{
+			_compact();
+		}
+
+		return !mFile.fail();
+	}
+
+	void RegionFile::removeChunk( size_t index )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		if( index >= ChunkCount ) return;
+
+		Entry& e = mHeader.entries[index];
+		if( e.sector == 0 ) return;
+
+		_release( e.sector, _sectorsFor( e.length ) );
+		e.sector = 0;
+		e.length = 0;
+		_writeEntry( index );
+		mFile.flush();
+	}
+
+	size_t RegionFile::_getWastedSectors()
+	{
+		return std::count( mUsedSectors.begin(), mUsedSectors.end(), false );
+	}
+
+	size_t RegionFile::getWastedSectors()
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		return _getWastedSectors();
+	}
+
+	void RegionFile::compact()
+	{
+		std::unique_lock<std::mutex> lock( mMutex );
+		while( mReaders > 0 )
+		{
+			mReadersDone.wait( lock );
+		}
+		_compact();
+	}
+
+	void RegionFile::_compact()
+	{
+		std::vector<size_t> order;
+		for( size_t i = 0; i < ChunkCount; i++ )
+		{
+			if( mHeader.entries[i].sector != 0 ) order.push_back( i );
+		}
+		std::sort( order.begin(), order.end(), [this]( size_t a, size_t b ) {
+			return mHeader.entries[a].sector < mHeader.entries[b].sector;
+		} );
+
+		// Chunks only ever move towards the start of the file, so reading each
+		// one fully before writing it can't overwrite anything still needed.
+		std::vector<char> buffer;
+		uint32_t next = HeaderSectors;
+		for( auto it = order.begin(); it != order.end(); ++it )
+		{
+			Entry& e = mHeader.entries[*it];
+			if( e.sector != next )
+			{
+				buffer.resize( e.length );
+				mFile.clear();
+				mFile.seekg( (std::streamoff)e.sector * SectorSize );
+				mFile.read( buffer.data(), e.length );
+				mFile.seekp( (std::streamoff)next * SectorSize );
+				mFile.write( buffer.data(), e.length );
+				e.sector = next;
+				_writeEntry( *it );
+			}
+			next += _sectorsFor( e.length );
+		}
+		mFile.flush();
+
+		mUsedSectors.assign( next, true );
+
+		size_t size = (size_t)next * SectorSize;
+		if( order.size() > 0 )
+		{
+			// The last chunk doesn't have to fill its final sector.
+			const Entry& last = mHeader.entries[order.back()];
+			size = (size_t)last.sector * SectorSize + last.length;
+		}
+		else
+		{
+			size = sizeof( Header );
+		}
+		// Pages past the new end can't stay mapped, there are no readers
+		// left holding the view.
+		mMap.reset();
+#ifdef WIN32
+		// Windows keeps the tail, the header is what decides what's in use.
+#else
+		if( truncate( mPath.c_str(), size ) != 0 )
+		{
+			Util::log( "Failed to truncate region file: " + mPath, Util::Warning );
+		}
+#endif
+	}
+};
@@ -13,6 +13,8 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "Geometry.h"
+#include "BufferArena.h"
+#include "OcclusionCuller.h"
 #include <Component.h>
 #include <BaseEntity.h>
 #include <Profiler.h>
@@ -33,12 +35,55 @@ mDrawFrustum( false ),
 mDrawWorld( true ),
 mWorldProgram( NULL ),
 mWorldTexture( NULL ),
-mGeomType( GEOM_FALLBACK )
+mGeomType( GEOM_FALLBACK ),
+mTerrainVertices( NULL ),
+mTerrainEdges( NULL ),
+mMultiDraw( false ),
+mIndirectBO( 0 ),
+mChunkOffsetBO( 0 ),
+mLodChunks( 0 ),
+mCulledChunks( 0 ),
+mEnclosedChunks( 0 ),
+mOcclusion( NULL ),
+mOccludedChunks( 0 )
 {
+	for( size_t l = 1; l < CHUNK_LOD_LEVELS; l++ )
+	{
+		mLodDistances[l - 1] = l * 4 * CHUNK_WIDTH;
+	}
 }
 
 Renderer::~Renderer(void)
 {
+	_deleteRetired();
+	delete mOcclusion;
+	delete mTerrainVertices;
+	delete mTerrainEdges;
+	
+	if( mIndirectBO != 0 ) glDeleteBuffers( 1, &mIndirectBO );
+	if( mChunkOffsetBO != 0 ) glDeleteBuffers( 1, &mChunkOffsetBO );
+}
+
+void Renderer::retireGeometry( Geometry* geometry )
+{
+	mRetiredMutex.lock();
+	mRetiredGeometry.push_back( geometry );
+	mRetiredMutex.unlock();
+}
+
+void Renderer::_deleteRetired()
+{
+	std::vector<Geometry*> retired;
+	mRetiredMutex.lock();
+	retired.swap( mRetiredGeometry );
+	mRetiredMutex.unlock();
+	
+	// GL defers freeing the buffers until the commands using them have finished.
+	for( auto it = retired.begin(); it != retired.end(); ++it )
+	{
+		if( mOcclusion != NULL ) mOcclusion->release( *it );
+		delete *it;
+	}
 }
 
 void Renderer::initialize(sf::RenderWindow& window)
@@ -98,6 +143,25 @@ void Renderer::initialize(sf::RenderWindow& window)
 	}
 	mWorldProgram->link();
 	
+	setOcclusionCulling( true );
+	
+	// Chunks share two large buffers when they can be drawn at an offset,
+	// otherwise each one gets its own.
+	if( GLEW_ARB_draw_elements_base_vertex )
+	{
+		mTerrainVertices = new Magnetite::BufferArena( GL_ARRAY_BUFFER, TerrainVertexArenaSize, sizeof(TerrainVertex) );
+		mTerrainEdges = new Magnetite::BufferArena( GL_ELEMENT_ARRAY_BUFFER, TerrainEdgeArenaSize, sizeof(GLedge) );
+		
+		// Every chunk in the arenas can then be drawn with one call, each
+		// draw's instance picks its chunk origin.
+		if( GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance && GLEW_ARB_instanced_arrays )
+		{
+			mMultiDraw = true;
+			glGenBuffers( 1, &mIndirectBO );
+			glGenBuffers( 1, &mChunkOffsetBO );
+		}
+	}
+	
 	//attrL = glGetAttribLocation( mWorldProgram.ref, "in_light" );
 
 	//mLightingProgram.vertex = loadShader("w_vertex.glsl", GL_VERTEX_SHADER);
@@ -172,6 +236,36 @@ void Renderer::setDebugMode( size_t debugMode )
 	mDebugMode = debugMode;
 }
 
+void Renderer::setOcclusionCulling( bool enabled )
+{
+	if( enabled && mOcclusion == NULL )
+	{
+		mOcclusion = new Magnetite::OcclusionCuller();
+	}
+	else if( !enabled )
+	{
+		delete mOcclusion;
+		mOcclusion = NULL;
+	}
+}
+
+bool Renderer::isOcclusionCulling()
+{
+	return mOcclusion != NULL;
+}
+
+void Renderer::setLodDistance( size_t level, float distance )
+{
+	if( level < 1 || level >= CHUNK_LOD_LEVELS ) return;
+	mLodDistances[level - 1] = distance;
+}
+
+float Renderer::getLodDistance( size_t level )
+{
+	if( level < 1 || level >= CHUNK_LOD_LEVELS ) return 0.f;
+	return mLodDistances[level - 1];
+}
+
 Camera* Renderer::getCamera()
 {
 	return mCamera;
@@ -211,6 +305,10 @@ void Renderer::render(double dt, World* world)
 {
 	totalTime += dt;
 	mFpsAvg = (mFpsAvg + (1/dt)) / 2;
+	
+	// Nothing from the last frame is still being drawn.
+	_deleteRetired();
+	
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
 	// Set up the projection matrix before we draw the world
@@ -259,18 +357,24 @@ void Renderer::render(double dt, World* world)
 				glBindTexture(GL_TEXTURE_2D, mWorldTexture->getName());
 			}
 			
-			// Just draw everything, need some occulusion technique.
-			auto regions = world->getRegions();
-			for( size_t r = 0;  r < world->getRegionCount(); r++ )
+			// Chunks drawn one at a time are translated into place instead.
+			GLint offsetAttribute = mWorldProgram->getAttributeIndex("in_offset");
+			if( offsetAttribute != -1 ) glVertexAttrib3f( offsetAttribute, 0.f, 0.f, 0.f );
+			
+			Perf::Profiler::get().begin("cull");
+			_cullChunks( world );
+			_occludeChunks();
+			Perf::Profiler::get().end("cull");
+			
+			if( mMultiDraw )
+			{
+				_renderChunksBatched();
+			}
+			else
 			{
-				if( regions[r] == NULL ) continue;
-				for( size_t c = 0; c < regions[r]->count(); c++ )
+				for( size_t i = 0; i < mVisibleChunks.size(); i++ )
 				{
-					auto chnk = regions[r]->get(c);
-					if( chnk )
-					{
-						_renderChunk( regions[r], chnk );
-					}
+					_renderChunk( mVisibleChunks[i], mVisibleGeometry[i] );
 				}
 			}
 			
@@ -306,6 +410,14 @@ void Renderer::render(double dt, World* world)
 			
 			//Detatch the world program
 			mWorldProgram->deactivate();
+			
+			// Test for next frame what is hidden behind everything drawn so far.
+			if( mOcclusion != NULL )
+			{
+				glLoadIdentity();
+				glMultMatrixf( glm::value_ptr( glm::inverse( mCamera->getMatrix() ) ) );
+				mOcclusion->runQueries();
+			}
 		}
 		
 		auto entities = world->getEntities();
@@ -344,13 +456,18 @@ void Renderer::render(double dt, World* world)
 	};
 
 	drawCrosshair( dt );
+	
+	if( mTerrainVertices != NULL )
+	{
+		mTerrainVertices->endFrame();
+		mTerrainEdges->endFrame();
+	}
 }
 
-void Renderer::_renderChunk( Magnetite::ChunkRegionPtr region, Chunk* chunk )
+void Renderer::_renderChunk( Chunk* chunk, TerrainGeometry* geom )
 {
-	if( !chunk->_hasChunkFlag( Chunk::MeshInvalid ) && chunk->getGeometry() != NULL && chunk->getVisibleFaceCount() > 0 )
+	if( geom != NULL && geom->edgeCount > 0 )
 	{
-		chunk->getMutex().lock();
 		rendered++;
 		// Sort out view Matrix.
 		glLoadIdentity();
@@ -362,27 +479,243 @@ void Renderer::_renderChunk( Magnetite::ChunkRegionPtr region, Chunk* chunk )
 		float z = chunk->getZ() * CHUNK_WIDTH;
 		glTranslatef(x,y,z);
 		
-		Geometry* geom = chunk->getGeometry();
+		if( !_uploadGeometry( geom ) ) return;
 		
-		if( geom->vertexBO == 0 || geom->indexBO == 0 )
+		if( geom->vertexArena != NULL )
+		{
+			glBindBuffer( GL_ARRAY_BUFFER, geom->vertexArena->getName() );
+			glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, geom->edgeArena->getName() );
+			
+			geom->bindVertexAttributes(mWorldProgram);
+			
+			glDrawRangeElementsBaseVertex( GL_TRIANGLES, 0, geom->vertexCount, geom->edgeCount, GL_UNSIGNED_SHORT,
+										   BUFFER_OFFSET(geom->edgeOffset), geom->vertexOffset / sizeof(TerrainVertex) );
+		}
+		else
+		{
+			glBindBuffer( GL_ARRAY_BUFFER, geom->vertexBO );
+			glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, geom->indexBO );
+			
+			geom->bindVertexAttributes(mWorldProgram);
+			
+			glDrawRangeElements( GL_TRIANGLES, 0, geom->vertexCount, geom->edgeCount, GL_UNSIGNED_SHORT, 0);
+		}
+
+		glBindBuffer( GL_ARRAY_BUFFER, 0 );
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+	}
+
+}
+
+bool Renderer::_uploadGeometry( TerrainGeometry* geom )
+{
+	if( !geom->isUploaded() )
+	{
+		// Fall back to separate buffers once the arenas are full.
+		if( mTerrainVertices == NULL || !geom->bindToArena( mTerrainVertices, mTerrainEdges ) )
 		{
 			geom->bindToBuffer();
-			if( geom->vertexBO == 0 || geom->indexBO == 0 ) return;
 		}
-        
-		glBindBuffer( GL_ARRAY_BUFFER, geom->vertexBO );
-		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, geom->indexBO );
+	}
+	return geom->isUploaded();
+}
+
+void Renderer::_cullChunks( World* world )
+{
+	mVisibleChunks.clear();
+	mCullChunks.clear();
+	mCullX.clear();
+	mCullY.clear();
+	mCullZ.clear();
+	mCulledChunks = 0;
+	mEnclosedChunks = 0;
+	
+	Frustum& frustum = mCamera->getFrustum();
+	frustum.updatePlanes();
+	
+	Vector3 chunkHalf( CHUNK_WIDTH / 2.f, CHUNK_HEIGHT / 2.f, CHUNK_WIDTH / 2.f );
+	Vector3 regionSize( REGION_SIZE * CHUNK_WIDTH, REGION_SIZE * CHUNK_HEIGHT, REGION_SIZE * CHUNK_WIDTH );
+	
+	auto regions = world->getRegions();
+	for( size_t r = 0;  r < world->getRegionCount(); r++ )
+	{
+		if( regions[r] == NULL ) continue;
+		
+		// Regions entirely inside or outside don't need their chunks tested.
+		Vector3 min( regions[r]->getX() * regionSize.x, regions[r]->getY() * regionSize.y, regions[r]->getZ() * regionSize.z );
+		int side = frustum.intersectsAABB( min, min + regionSize );
+		
+		for( size_t c = 0; c < regions[r]->count(); c++ )
+		{
+			Chunk* chnk = regions[r]->get(c);
+			if( chnk == NULL ) continue;
+			
+			if( !world->isPotentiallyVisible( chnk ) )
+			{
+				mEnclosedChunks++;
+			}
+			else if( side == Frustum::OUTSIDE )
+			{
+				mCulledChunks++;
+			}
+			else if( side == Frustum::INSIDE )
+			{
+				mVisibleChunks.push_back( chnk );
+			}
+			else
+			{
+				mCullChunks.push_back( chnk );
+				mCullX.push_back( chnk->getX() * CHUNK_WIDTH + chunkHalf.x );
+				mCullY.push_back( chnk->getY() * CHUNK_HEIGHT + chunkHalf.y );
+				mCullZ.push_back( chnk->getZ() * CHUNK_WIDTH + chunkHalf.z );
+			}
+		}
+	}
+	
+	mCullResults.resize( mCullChunks.size() );
+	frustum.cullBoxes( mCullX.data(), mCullY.data(), mCullZ.data(), mCullChunks.size(), chunkHalf, mCullResults.data() );
+	for( size_t i = 0; i < mCullChunks.size(); i++ )
+	{
+		if( mCullResults[i] ) mVisibleChunks.push_back( mCullChunks[i] );
+		else mCulledChunks++;
+	}
+}
+
+TerrainGeometry* Renderer::_chooseGeometry( Chunk* chunk, const Vector3& eye )
+{
+	Vector3 center( ( chunk->getX() + 0.5f ) * CHUNK_WIDTH, ( chunk->getY() + 0.5f ) * CHUNK_HEIGHT, ( chunk->getZ() + 0.5f ) * CHUNK_WIDTH );
+	float distance = glm::length( center - eye );
+	
+	size_t level = 0;
+	while( level < CHUNK_LOD_LEVELS - 1 && distance > mLodDistances[level] )
+	{
+		level++;
+	}
+	
+	// Load the geometry once, the chunk may publish a new one while this draws the old.
+	TerrainGeometry* geom = chunk->getGeometry( level );
+	if( geom == NULL && level > 0 )
+	{
+		// Chunks meshed near the camera skip the coarse levels.
+		chunk->requestLod();
+	}
+	while( geom == NULL && level > 0 )
+	{
+		geom = chunk->getGeometry( --level );
+	}
+	
+	if( level > 0 ) mLodChunks++;
+	return geom;
+}
+
+void Renderer::_occludeChunks()
+{
+	mOccludedChunks = 0;
+	mLodChunks = 0;
+	mVisibleGeometry.clear();
+	Vector3 eye = mCamera->getPosition();
+	Vector3 chunkSize( CHUNK_WIDTH, CHUNK_HEIGHT, CHUNK_WIDTH );
+	
+	size_t kept = 0;
+	for( size_t i = 0; i < mVisibleChunks.size(); i++ )
+	{
+		Chunk* chnk = mVisibleChunks[i];
+		TerrainGeometry* geom = chnk->getGeometry();
+		if( geom == NULL || geom->edgeCount == 0 ) continue;
+		
+		if( mOcclusion != NULL )
+		{
+			// Queries stay with the full detail mesh as the level changes.
+			Vector3 min( chnk->getX() * CHUNK_WIDTH, chnk->getY() * CHUNK_HEIGHT, chnk->getZ() * CHUNK_WIDTH );
+			if( !mOcclusion->isVisible( geom, min, min + chunkSize, eye ) )
+			{
+				mOccludedChunks++;
+				continue;
+			}
+		}
 		
-		geom->bindVertexAttributes(mWorldProgram);
+		geom = _chooseGeometry( chnk, eye );
+		if( geom == NULL || geom->edgeCount == 0 ) continue;
 		
-		glDrawRangeElements( GL_TRIANGLES, 0, geom->vertexCount, geom->edgeCount, GL_UNSIGNED_SHORT, 0);
+		mVisibleChunks[kept++] = chnk;
+		mVisibleGeometry.push_back( geom );
+	}
+	mVisibleChunks.resize( kept );
+}
 
+void Renderer::_renderChunksBatched()
+{
+	mDrawCommands.clear();
+	mDrawOffsets.clear();
+	mUnbatchedChunks.clear();
+	
+	for( size_t i = 0; i < mVisibleChunks.size(); i++ )
+	{
+		Chunk* chnk = mVisibleChunks[i];
+		TerrainGeometry* geom = mVisibleGeometry[i];
+		if( !_uploadGeometry( geom ) ) continue;
+		
+		if( geom->vertexArena == NULL )
+		{
+			mUnbatchedChunks.push_back( i );
+			continue;
+		}
+		
+		DrawElementsIndirectCommand command;
+		command.count = geom->edgeCount;
+		command.instanceCount = 1;
+		command.firstIndex = geom->edgeOffset / sizeof(GLedge);
+		command.baseVertex = geom->vertexOffset / sizeof(TerrainVertex);
+		command.baseInstance = mDrawCommands.size();
+		mDrawCommands.push_back( command );
+		
+		mDrawOffsets.push_back( chnk->getX() * CHUNK_WIDTH );
+		mDrawOffsets.push_back( chnk->getY() * CHUNK_HEIGHT );
+		mDrawOffsets.push_back( chnk->getZ() * CHUNK_WIDTH );
+	}
+	
+	if( !mDrawCommands.empty() )
+	{
+		rendered += mDrawCommands.size();
+		
+		glLoadIdentity();
+		glMultMatrixf( glm::value_ptr( glm::inverse( mCamera->getMatrix() ) ) );
+		
+		// Both buffers are orphaned and refilled every frame.
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, mIndirectBO );
+		glBufferData( GL_DRAW_INDIRECT_BUFFER, mDrawCommands.size() * sizeof(DrawElementsIndirectCommand), mDrawCommands.data(), GL_STREAM_DRAW );
+		
+		GLint offsetAttribute = mWorldProgram->getAttributeIndex("in_offset");
+		glBindBuffer( GL_ARRAY_BUFFER, mChunkOffsetBO );
+		glBufferData( GL_ARRAY_BUFFER, mDrawOffsets.size() * sizeof(GLfloat), mDrawOffsets.data(), GL_STREAM_DRAW );
+		if( offsetAttribute != -1 )
+		{
+			mWorldProgram->setVertexAttribute( "in_offset", 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0) );
+			glVertexAttribDivisorARB( offsetAttribute, 1 );
+		}
+		
+		glBindBuffer( GL_ARRAY_BUFFER, mTerrainVertices->getName() );
+		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, mTerrainEdges->getName() );
+		TerrainGeometry::bindTerrainAttributes( mWorldProgram );
+		
+		glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_SHORT, BUFFER_OFFSET(0), mDrawCommands.size(), 0 );
+		
+		if( offsetAttribute != -1 )
+		{
+			glVertexAttribDivisorARB( offsetAttribute, 0 );
+			glDisableVertexAttribArray( offsetAttribute );
+			glVertexAttrib3f( offsetAttribute, 0.f, 0.f, 0.f );
+		}
+		
+		glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
 		glBindBuffer( GL_ARRAY_BUFFER, 0 );
 		glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
-		
-		chunk->getMutex().unlock();
 	}
-
+	
+	for( auto it = mUnbatchedChunks.begin(); it != mUnbatchedChunks.end(); ++it )
+	{
+		_renderChunk( mVisibleChunks[*it], mVisibleGeometry[*it] );
+	}
 }
 
 void Renderer::drawStats(double dt, size_t chunkCount, World* world)
@@ -398,10 +731,19 @@ void Renderer::drawStats(double dt, size_t chunkCount, World* world)
 	ss << "\tgame think: " << perf.getLastTime( "gthink" ) << "ms" << std::endl;
 	ss << "\tpaging: " << perf.getLastTime( "page" ) << "ms" << std::endl;
 	ss << "\tdraw: " << perf.getLastTime( "draw" ) << "ms" << std::endl;
+	ss << "\tcull: " << perf.getLastTime( "cull" ) << "ms" << std::endl;
 	ss << "\tTimescale: " << MagnetiteCore::Singleton->getTimescale() << std::endl;
 	ss << "World Stats: " << std::endl;
 	ss << "\tBlocks: " << mBlRendered << "/" << mBlTotal << " - " << percent <<  std::endl;
 	ss << "\tRendered Chunks: " << chunkCount << std::endl;
+	ss << "\tCulled Chunks: " << mCulledChunks << std::endl;
+	ss << "\tEnclosed Chunks: " << mEnclosedChunks << std::endl;
+	ss << "\tOccluded Chunks: " << mOccludedChunks << std::endl;
+	ss << "\tLOD Chunks: " << mLodChunks << std::endl;
+	if( mTerrainVertices != NULL )
+	{
+		ss << "\tMesh Memory: " << ( mTerrainVertices->getUsedSize() + mTerrainEdges->getUsedSize() ) / 1024 << "KB" << std::endl;
+	}
 	ss << "\tEntity Count: " << world->getEntities().size() << std::endl;
 	ss << "\tTime: " << world->getSky()->getTime() % DAY_LENGTH << std::endl;
 	ss << "Camera: " << std::endl;
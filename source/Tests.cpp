@@ -2,6 +2,11 @@
 #include "World.h"
 #include "BaseBlock.h"
 #include "Renderer.h"
+#include "ChunkCodec.h"
+#include "Chunk.h"
+#include "BlockFactory.h"
+#include "LightingManager.h"
+#include "BlockStorage.h"
 
 int tests = 0, failed = 0;
 
@@ -16,9 +21,218 @@ void _fireAssert( bool condition, std::string name, std::string loc )
 }
 #define _str(x) #x
 #define _ass( cond, error ) \
-	_fireAssert( cond, error, "("__FILE__" at line " + Util::toString(__LINE__) + ")");
+	_fireAssert( cond, error, "(" __FILE__ " at line " + Util::toString(__LINE__) + ")");
 
-void runTests()
+/**
+ * Encodes the arrays and decodes them again, returns false if decoding
+ * fails or gives back anything different.
+ */
+bool _roundTripChunk( const std::vector<uint32_t>& blocks, const std::vector<LightIndex>& light, std::vector<char>& encoded )
+{
+	Magnetite::ChunkCodec::encode( blocks.data(), light.data(), encoded );
+	
+	std::vector<uint32_t> decodedBlocks( CHUNK_SIZE, 0xDEADBEEF );
+	std::vector<LightIndex> decodedLight( CHUNK_SIZE, 1 );
+	bool ok = Magnetite::ChunkCodec::decode( encoded.data(), encoded.size(),
+		[&]( size_t start, size_t count, uint32_t value ) { std::fill( decodedBlocks.begin() + start, decodedBlocks.begin() + start + count, value ); },
+		[&]( size_t start, size_t count, uint32_t value ) { std::fill( decodedLight.begin() + start, decodedLight.begin() + start + count, (LightIndex)value ); } );
+	
+	return ok && decodedBlocks == blocks && decodedLight == light;
+}
+
+void _testChunkCodec()
 {
+	auto ignore = []( size_t, size_t, uint32_t ) {};
+	std::vector<char> empty, uniform, runs;
+	
+	std::vector<uint32_t> blocks( CHUNK_SIZE, 0 );
+	std::vector<LightIndex> light( CHUNK_SIZE, 0 );
+	_ass( _roundTripChunk( blocks, light, empty ), "Empty chunk round trip" );
+	
+	// The largest id takes all five bytes of its varint.
+	std::fill( blocks.begin(), blocks.end(), 0xFFFFFFFF );
+	std::fill( light.begin(), light.end(), 200 );
+	_ass( _roundTripChunk( blocks, light, uniform ), "Uniform chunk round trip" );
+	_ass( uniform.size() > empty.size(), "Uniform chunk stores its value" );
+	
+	// Its last varint byte is just before the light byte, a fifth byte
+	// with more than 4 bits would overflow.
+	std::vector<char> overflow = uniform;
+	overflow[ overflow.size() - 2 ] = 0x1F;
+	_ass( !Magnetite::ChunkCodec::decode( overflow.data(), overflow.size(), ignore, ignore ), "Overlong varint is rejected" );
+	
+	for( size_t i = 0; i < CHUNK_SIZE; i++ )
+	{
+		blocks[i] = ( i / 100 ) % 7 == 0 ? 0 : (uint32_t)( i / 1000 ) * 300;
+		light[i] = ( i % CHUNK_WIDTH ) < 16 ? 255 : (LightIndex)( i % 17 );
+	}
+	_ass( _roundTripChunk( blocks, light, runs ), "Run length chunk round trip" );
+	_ass( !Magnetite::ChunkCodec::decode( runs.data(), runs.size() / 2, ignore, ignore ), "Truncated chunk is rejected" );
+	
+	// The payload length is the last field of the header.
+	std::vector<char> oversized = runs;
+	uint32_t hugeLength = 0xFFFFFFF0;
+	memcpy( oversized.data() + 8, &hugeLength, sizeof( hugeLength ) );
+	_ass( !Magnetite::ChunkCodec::decode( oversized.data(), oversized.size(), ignore, ignore ), "Oversized payload length is rejected" );
+}
 
+/**
+ * A block type for the storage tests, opacity and state are chosen for
+ * each instance.
+ */
+class TestBlock : public BaseBlock
+{
+	bool mOpaque;
+	bool mStateful;
+public:
+	static int destroyed;
+	
+	TestBlock( bool opaque = true, bool stateful = false )
+	: mOpaque( opaque ), mStateful( stateful )
+	{
+	}
+	
+	~TestBlock()
+	{
+		destroyed++;
+	}
+	
+	void created() {}
+	void hit() {}
+	bool isOpaque() { return mOpaque; }
+	bool hasState() { return mStateful; }
+	std::string getType() { return "test"; }
+};
+int TestBlock::destroyed = 0;
+
+void _testBlockStorage()
+{
+	// More types than 8 bit indices can hold alongside air.
+	std::vector<TestBlock> types( 300 );
+	Magnetite::BlockStorage storage;
+	_ass( storage.getIndexBits() == 0, "Empty storage has no indices" );
+	
+	// Each width holds 2^bits entries including air, one more type widens it.
+	// Voxels are spread out so they land in different words.
+	const uint8_t widths[] = { 1, 2, 4, 8, 16 };
+	size_t placed = 0;
+	for( size_t w = 0; w < sizeof( widths ); w++ )
+	{
+		size_t capacity = std::min<size_t>( ( 1u << widths[w] ) - 1, types.size() );
+		for( ; placed < capacity; placed++ )
+		{
+			storage.set( placed * 97 % CHUNK_SIZE, &types[placed] );
+		}
+		_ass( storage.getIndexBits() == widths[w], "Indices widen to " + Util::toString( (int)widths[w] ) + " bits" );
+		
+		bool intact = true;
+		for( size_t i = 0; i < placed; i++ )
+		{
+			intact = intact && storage.get( i * 97 % CHUNK_SIZE ) == &types[i];
+		}
+		_ass( intact, "Blocks survive widening to " + Util::toString( (int)widths[w] ) + " bits" );
+	}
+	
+	size_t stored = 0;
+	for( size_t i = 0; i < CHUNK_SIZE; i++ )
+	{
+		if( storage.get( i ) != NULL ) stored++;
+	}
+	_ass( stored == placed, "Only placed voxels hold blocks" );
+	_ass( storage.getPaletteSize() == placed + 1, "Palette holds every type and air" );
+	
+	// Clearing the only voxel of a type frees its entry for the next new type.
+	size_t freedVoxel = 5 * 97 % CHUNK_SIZE;
+	Magnetite::BlockStorage::PaletteIndex freed = storage.getIndex( freedVoxel );
+	storage.remove( freedVoxel );
+	_ass( storage.get( freedVoxel ) == NULL && storage.getPaletteSize() == placed, "Cleared type leaves the palette" );
+	TestBlock extra;
+	storage.set( 1, &extra );
+	_ass( storage.getIndex( 1 ) == freed, "Freed palette entry is reused" );
+	_ass( storage.get( 1 ) == &extra && storage.get( 6 * 97 % CHUNK_SIZE ) == &types[6], "Reused entry leaves other types alone" );
+	
+	// Stateful blocks share one entry but keep their own instances.
+	TestBlock::destroyed = 0;
+	TestBlock* first = new TestBlock( true, true );
+	TestBlock* second = new TestBlock( true, true );
+	storage.set( 2, first );
+	storage.set( 3, second );
+	_ass( storage.getIndex( 2 ) == storage.getIndex( 3 ), "Stateful blocks share an entry" );
+	_ass( storage.get( 2 ) == first && storage.get( 3 ) == second, "Stateful blocks keep their instances" );
+	storage.set( 2, &types[0] );
+	_ass( TestBlock::destroyed == 1 && storage.get( 2 ) == &types[0] && storage.get( 3 ) == second, "Replaced stateful block is deleted" );
+	storage.remove( 3 );
+	_ass( TestBlock::destroyed == 2 && storage.get( 3 ) == NULL, "Removed stateful block is deleted" );
+	TestBlock* third = new TestBlock( true, true );
+	storage.set( 4, third );
+	_ass( storage.get( 4 ) == third, "Stateful entry is created again once freed" );
+}
+
+void _testRowMasks()
+{
+	TestBlock solid, glass( false );
+	Magnetite::BlockStorage storage;
+	storage.set( BLOCK_INDEX_2( 0, 0, 0 ), &solid );
+	storage.set( BLOCK_INDEX_2( 31, 0, 0 ), &solid );
+	storage.set( BLOCK_INDEX_2( 5, 0, 0 ), &glass );
+	storage.set( BLOCK_INDEX_2( 7, 0, 0 ), new TestBlock( false, true ) );
+	storage.set( BLOCK_INDEX_2( 3, 2, 1 ), &solid );
+	
+	const size_t rows = CHUNK_SIZE / CHUNK_WIDTH;
+	std::vector<uint32_t> solidRows( rows, 0xFFFFFFFF ), opaqueRows( rows, 0xFFFFFFFF );
+	storage.getRowMasks( solidRows.data(), opaqueRows.data() );
+	
+	// Rows run along x, the row of a voxel is z * CHUNK_HEIGHT + y.
+	std::vector<uint32_t> expectSolid( rows, 0 ), expectOpaque( rows, 0 );
+	expectSolid[0] = ( 1u << 0 ) | ( 1u << 31 ) | ( 1u << 5 ) | ( 1u << 7 );
+	expectOpaque[0] = ( 1u << 0 ) | ( 1u << 31 );
+	expectSolid[CHUNK_HEIGHT + 2] = expectOpaque[CHUNK_HEIGHT + 2] = 1u << 3;
+	_ass( solidRows == expectSolid, "Row masks mark every block as solid" );
+	_ass( opaqueRows == expectOpaque, "Row masks only mark opaque blocks as opaque" );
+}
+
+void _testStackedLight()
+{
+	BaseBlock* stone = FactoryManager::getManager().getBlockType( "stone" );
+	Chunk air( ChunkIndex{ 0, 1, 0 }, nullptr );
+	Chunk ground( ChunkIndex{ 0, 0, 0 }, nullptr );
+	for( long z = 0; z < CHUNK_WIDTH; z++ ) {
+		for( long x = 0; x < CHUNK_WIDTH; x++ ) {
+			for( long y = 0; y < CHUNK_HEIGHT / 2; y++ ) {
+				ground.setBlockAt( stone, x, y, z );
+			}
+		}
+	}
+	
+	// The ground is lit first, against air that hasn't been lit yet.
+	Magnetite::ChunkNeighbourhood groundHood;
+	groundHood.gatherChunk( &ground );
+	groundHood.gatherNeighbour( &air, 0, 1, 0 );
+	LightingManager::lightChunk( &ground, groundHood );
+	_ass( ground.getLightLevel( 3, CHUNK_HEIGHT - 1, 3 ) == 0, "Ground under unlit air starts dark" );
+	
+	Magnetite::ChunkNeighbourhood airHood;
+	airHood.gatherChunk( &air );
+	airHood.gatherNeighbour( &ground, 0, -1, 0 );
+	int faces = LightingManager::lightChunk( &air, airHood );
+	_ass( air.getLightLevel( 3, 0, 3 ) == LightingManager::Sunlight, "Empty chunk under open sky is lit" );
+	_ass( ( faces & ( 1 << FACE_INDEX_BOTTOM ) ) != 0, "Lighting the air flags the ground below" );
+	
+	// Lit again as generateLighting does for a flagged neighbour.
+	Magnetite::ChunkNeighbourhood relitHood;
+	relitHood.gatherChunk( &ground );
+	relitHood.gatherNeighbour( &air, 0, 1, 0 );
+	LightingManager::lightChunk( &ground, relitHood );
+	_ass( ground.getLightLevel( 3, CHUNK_HEIGHT - 1, 3 ) == LightingManager::Sunlight, "Ground under lit air gets sunlight" );
+	_ass( ground.getLightLevel( 7, CHUNK_HEIGHT / 2, 5 ) == LightingManager::Sunlight, "Sunlight reaches the surface" );
+}
+
+void runTests()
+{
+	_testChunkCodec();
+	_testBlockStorage();
+	_testRowMasks();
+	_testStackedLight();
+	
+	Util::log( Util::toString( tests - failed ) + "/" + Util::toString( tests ) + " tests passed" );
 }
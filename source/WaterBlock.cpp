@@ -3,14 +3,13 @@
 #include "TextureManager.h"
 #include "MagnetiteCore.h"
 #include "Renderer.h"
+#include "Chunk.h"
 
 //REGISTER_BLOCK_TYPE( "stone", StoneBlock )
 GenericBlockFactory<WaterBlock> waterFactory("water");
 
 WaterBlock::WaterBlock()
-: BaseBlock(),
-mFluidLevel( 100.f ),
-mIsNew( true )
+: BaseBlock()
 {
 }
 
@@ -55,19 +54,27 @@ void WaterBlock::connectedChange( short face )
 
 }
 
-float WaterBlock::getFluidLevel()
+/**
+ * Index of the context's block inside its chunk.
+ */
+static size_t contextIndex( BlockContext& ctx )
 {
-	return mFluidLevel;
+	return BLOCK_INDEX_2( (size_t)ctx.worldX % CHUNK_WIDTH, (size_t)ctx.worldY % CHUNK_HEIGHT, (size_t)ctx.worldZ % CHUNK_WIDTH );
 }
 
-void WaterBlock::changeFluidLevel( float delta )
+float WaterBlock::getFluidLevel( BlockContext& ctx )
 {
-	setFluidLevel(mFluidLevel + delta);
+	return ctx.chunk->getFluidLevel( contextIndex( ctx ) );
 }
 
-void WaterBlock::setFluidLevel( float delta )
+void WaterBlock::changeFluidLevel( BlockContext& ctx, float delta )
 {
-	mFluidLevel = delta;
+	setFluidLevel( ctx, getFluidLevel( ctx ) + delta );
+}
+
+void WaterBlock::setFluidLevel( BlockContext& ctx, float level )
+{
+	ctx.chunk->setFluidLevel( contextIndex( ctx ), level );
 	//if( mChunk ) {
 	//	mChunk->markModified();
 	//	if( mFluidLevel <= 1.0f )
@@ -77,16 +84,16 @@ void WaterBlock::setFluidLevel( float delta )
 
 static float FLOW_MAX = 60.0f; // Maximum flow per second
 
-void WaterBlock::balanceFluid( BaseBlock* block, float dt )
+void WaterBlock::balanceFluid( BlockContext& ctx, BlockContext& other, float dt )
 {
-	if( block->getType() == this->getType() )
+	BaseBlock* block = other.chunk->getBlockAt( contextIndex( other ) );
+	if( block == this )
 	{
-		WaterBlock* water = (WaterBlock*)block;
-		float dif = mFluidLevel - water->getFluidLevel();
+		float dif = getFluidLevel( ctx ) - getFluidLevel( other );
 		if( dif > 0.0001f ) {
 			dif = std::min(dif, FLOW_MAX * dt);
-			water->changeFluidLevel( dif / 2.f );
-			changeFluidLevel( -dif / 2.f );
+			changeFluidLevel( other, dif / 2.f );
+			changeFluidLevel( ctx, -dif / 2.f );
 		}
 	}
 }
@@ -136,7 +143,7 @@ void WaterBlock::flowToBlock(unsigned short x, unsigned short y, unsigned short
 
 }
 
-void WaterBlock::flow( float dt )
+void WaterBlock::flow( BlockContext& ctx, float dt )
 {
 	/*if( mIsNew == true ) {
 		mIsNew = false;
@@ -10,6 +10,7 @@
 #include <BlockTriangulator.h>
 #include <BaseEntity.h>
 #include <WorldSerializer.h>
+#include <JobPool.h>
 #include <Profiler.h>
 #include <iostream>
 #include <fstream>
@@ -26,9 +27,34 @@
 // For convenience
 #define c2i( x, y, z ) ( z * mWorldSize * mWorldSize + y * mWorldSize + x )
 
+ChunkJob::ChunkJob( ChunkScalar x, ChunkScalar y, ChunkScalar z )
+: x( x ), y( y ), z( z ),
+chunk( nullptr ),
+cancelled( false )
+{
+}
+
+ChunkJob::~ChunkJob()
+{
+	// Only set if the chunk was never published.
+	delete chunk;
+}
+
 World::World( size_t edgeSize )
 : mSky( NULL ),
+mGenerator( new ChunkGenerator( 0 ) ),
 mTriangulator( new BlockTriangulator() ),
+mJobPool( NULL ),
+mCheckpointInterval( 30.f ),
+mCheckpointTimer( 0.f ),
+mCheckpointing( false ),
+mCheckpointCursor( 0 ),
+mCheckpointSaved( 0 ),
+mVisibilityStamp( 0 ),
+mVisibilityDirty( true ),
+mVisibilityX( -1 ),
+mVisibilityY( -1 ),
+mVisibilityZ( -1 ),
 mThreadID(std::this_thread::get_id())
 {	
 	mWorldSize = edgeSize;
@@ -46,13 +72,102 @@ mThreadID(std::this_thread::get_id())
 	printDbg = false;
 	
 	mSerializer = new Magnetite::WorldSerializer(this);
+	
+	mJobPool = new Magnetite::JobPool();
 }
 
 World::~World()
 {
+	// Wait for the workers before the chunks they might be reading go away.
+	delete mJobPool;
+	mChunkJobs.clear();
+	mCompletedJobs.clear();
+	
+	// Anything modified since the last checkpoint would be lost otherwise.
+	checkpoint();
 	destoryWorld();
 	
 	delete mSerializer;
+	delete mGenerator;
+}
+
+void World::setWorkerCount( size_t workers )
+{
+	mJobPool->setThreadCount( workers );
+}
+
+size_t World::getWorkerCount()
+{
+	return mJobPool->getThreadCount();
+}
+
+void World::checkpoint()
+{
+	size_t saved = 0;
+	auto wcube = mWorldSize*mWorldSize*mWorldSize;
+	for( size_t r = 0; r < wcube; r++ )
+	{
+		if( mRegions[r] == nullptr ) continue;
+		for( size_t c = 0; c < mRegions[r]->count(); c++ )
+		{
+			Chunk* chunk = mRegions[r]->get(c);
+			if( chunk != nullptr && chunk->isModified() )
+			{
+				mSerializer->saveChunk( chunk->getX(), chunk->getY(), chunk->getZ() );
+				saved++;
+			}
+		}
+	}
+	
+	if( saved > 0 )
+	{
+		Util::log( "Checkpoint saved " + Util::toString( saved ) + " chunks" );
+	}
+}
+
+void World::_continueCheckpoint()
+{
+	const size_t regionChunks = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+	const size_t end = mWorldSize * mWorldSize * mWorldSize * regionChunks;
+	size_t saved = 0;
+	while( mCheckpointCursor < end && saved < MaxSavesPerUpdate )
+	{
+		size_t r = mCheckpointCursor / regionChunks;
+		if( mRegions[r] == nullptr )
+		{
+			mCheckpointCursor = ( r + 1 ) * regionChunks;
+			continue;
+		}
+		
+		Chunk* chunk = mRegions[r]->get( mCheckpointCursor % regionChunks );
+		if( chunk != nullptr && chunk->isModified() )
+		{
+			// Leave the chunk for the next update once the I/O thread has made room.
+			if( !mSerializer->saveChunk( chunk->getX(), chunk->getY(), chunk->getZ(), false ) ) return;
+			saved++;
+		}
+		mCheckpointCursor++;
+	}
+	mCheckpointSaved += saved;
+	
+	if( mCheckpointCursor >= end )
+	{
+		mCheckpointing = false;
+		if( mCheckpointSaved > 0 )
+		{
+			Util::log( "Checkpoint saved " + Util::toString( mCheckpointSaved ) + " chunks" );
+		}
+	}
+}
+
+void World::setCheckpointInterval( float seconds )
+{
+	mCheckpointInterval = seconds;
+}
+
+float World::getCheckpointInterval()
+{
+	return mCheckpointInterval;
 }
 
 Magnetite::String World::getName()
@@ -67,7 +182,23 @@ void World::setName( const Magnetite::String& name )
 
 BaseTriangulator* World::getTriangulator()
 {
-	return mTriangulator;
+	return mTriangulator.get();
+}
+
+void World::setTriangulator( BaseTriangulator* triangulator )
+{
+	mTriangulator.reset( triangulator );
+	
+	auto wcube = mWorldSize*mWorldSize*mWorldSize;
+	for( size_t r = 0; r < wcube; r++ )
+	{
+		if( mRegions[r] == nullptr ) continue;
+		for( size_t c = 0; c < mRegions[r]->count(); c++ )
+		{
+			Chunk* chunk = mRegions[r]->get(c);
+			if( chunk != nullptr ) chunk->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+		}
+	}
 }
 
 BlockPtr World::getBlockAt( long x, long y, long z )
@@ -103,7 +234,13 @@ void World::removeBlockAt( long x, long y, long z )
 	
 	if( c == NULL ) return;
 	
+	// The light around the block is updated in _applyBlockChanges.
+	c->_raiseChunkFlag( Chunk::SkipLight );
 	c->removeBlockAt( x % CHUNK_WIDTH, y % CHUNK_HEIGHT, z % CHUNK_WIDTH );
+	
+	mBlockChangeMutex.lock();
+	mBlockChanges.push_back( BlockChange{ x, y, z } );
+	mBlockChangeMutex.unlock();
 }
 
 void World::setBlockAt( BaseBlock* b, long x, long y, long z )
@@ -118,9 +255,69 @@ void World::setBlockAt( BaseBlock* b, long x, long y, long z )
 	ChunkScalar cz = (z / CHUNK_WIDTH) % REGION_SIZE;
 	
 	auto c = r->get( cx, cy, cz );
-	if( c == NULL ) c = r->create( cx, cy, cz );
+	if( c == NULL )
+	{
+		c = r->create( cx, cy, cz );
+	}
+	else
+	{
+		// The light around the block is updated in _applyBlockChanges,
+		// new chunks still need lighting as a whole.
+		c->_raiseChunkFlag( Chunk::SkipLight );
+	}
 	
 	c->setBlockAt( b, x % CHUNK_WIDTH, y % CHUNK_HEIGHT, z % CHUNK_WIDTH );
+	
+	mBlockChangeMutex.lock();
+	mBlockChanges.push_back( BlockChange{ x, y, z } );
+	mBlockChangeMutex.unlock();
+}
+
+void World::_applyBlockChanges()
+{
+	std::vector<BlockChange> changes;
+	mBlockChangeMutex.lock();
+	changes.swap( mBlockChanges );
+	mBlockChangeMutex.unlock();
+	if( changes.empty() ) return;
+	
+	std::vector<Chunk*> changed;
+	for( auto it = changes.begin(); it != changes.end(); ++it )
+	{
+		// Each update assumes the light was right before it, so once one has
+		// to wait for a busy chunk the rest wait with it, in order.
+		if( !LightingManager::updateBlock( this, it->x, it->y, it->z, changed ) )
+		{
+			mBlockChangeMutex.lock();
+			mBlockChanges.insert( mBlockChanges.begin(), it, changes.end() );
+			mBlockChangeMutex.unlock();
+			break;
+		}
+		
+		// A block on the edge of its chunk changes the faces across it.
+		long cx = it->x / CHUNK_WIDTH, cy = it->y / CHUNK_HEIGHT, cz = it->z / CHUNK_WIDTH;
+		long lx = it->x % CHUNK_WIDTH, ly = it->y % CHUNK_HEIGHT, lz = it->z % CHUNK_WIDTH;
+		Chunk* across[] = {
+			lx == 0 ? getChunk( cx - 1, cy, cz ) : nullptr,
+			lx == CHUNK_WIDTH - 1 ? getChunk( cx + 1, cy, cz ) : nullptr,
+			ly == 0 ? getChunk( cx, cy - 1, cz ) : nullptr,
+			ly == CHUNK_HEIGHT - 1 ? getChunk( cx, cy + 1, cz ) : nullptr,
+			lz == 0 ? getChunk( cx, cy, cz - 1 ) : nullptr,
+			lz == CHUNK_WIDTH - 1 ? getChunk( cx, cy, cz + 1 ) : nullptr
+		};
+		for( size_t i = 0; i < sizeof( across ) / sizeof( Chunk* ); i++ )
+		{
+			if( across[i] != nullptr && std::find( changed.begin(), changed.end(), across[i] ) == changed.end() )
+			{
+				changed.push_back( across[i] );
+			}
+		}
+	}
+	
+	for( auto it = changed.begin(); it != changed.end(); ++it )
+	{
+		(*it)->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+	}
 }
 
 void World::moveBlock( long x, long y, long z, float time, long ex, long ey, long ez )
@@ -188,7 +385,8 @@ Chunk* World::getChunk(const long x, const long y, const long z)
 	ChunkScalar rx = x / REGION_SIZE;
 	ChunkScalar ry = y / REGION_SIZE;
 	ChunkScalar rz = z / REGION_SIZE;
-	Magnetite::ChunkRegionPtr r = getRegion(rx, ry, rz);
+	// Looking a chunk up shouldn't create its region.
+	Magnetite::ChunkRegionPtr r = findRegion(rx, ry, rz);
 	if( r == NULL ) return nullptr;
 	return r->get( x % REGION_SIZE, y % REGION_SIZE, z % REGION_SIZE );
 }
@@ -209,22 +407,57 @@ Magnetite::ChunkRegionPtr World::getRegion( const ChunkScalar x, const ChunkScal
 	return mRegions[index];
 }
 
+Magnetite::ChunkRegionPtr World::findRegion( const ChunkScalar x, const ChunkScalar y, const ChunkScalar z )
+{
+	if( x < 0 || x > mWorldSize-1 || y < 0 || y > mWorldSize-1 || z < 0 || z > mWorldSize-1 )
+	{
+		return NULL;
+	}
+	return mRegions[c2i( x, y, z )];
+}
+
 void World::requestChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 {
 	mWorldMutex.lock();
-	ChunkRequest r = { x, y, z, false } ;
-	mChunkRequests.push_back( r );
+	auto it = mChunkRequests.find( _chunkJobKey( x, y, z ) );
+	if( it != mChunkRequests.end() && it->second.unload )
+	{
+		// The chunk never left.
+		mChunkRequests.erase( it );
+	}
+	else if( it == mChunkRequests.end() )
+	{
+		ChunkRequest r = { x, y, z, false, 0.f };
+		mChunkRequests[ _chunkJobKey( x, y, z ) ] = r;
+	}
 	mWorldMutex.unlock();
 }
 
 void World::requestChunkUnload( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 {
 	mWorldMutex.lock();
-	ChunkRequest r = { x, y, z, true } ;
-	mChunkRequests.push_back( r );
+	auto it = mChunkRequests.find( _chunkJobKey( x, y, z ) );
+	if( it != mChunkRequests.end() && !it->second.unload )
+	{
+		// The chunk was never loaded.
+		mChunkRequests.erase( it );
+	}
+	else if( it == mChunkRequests.end() )
+	{
+		ChunkRequest r = { x, y, z, true, 0.f };
+		mChunkRequests[ _chunkJobKey( x, y, z ) ] = r;
+	}
 	mWorldMutex.unlock();
 }
 
+/**
+ * Orders chunk requests by priority.
+ */
+static bool compareRequests( const ChunkRequest* a, const ChunkRequest* b )
+{
+	return a->priority < b->priority;
+}
+
 Chunk* World::createChunk(long x, long y, long z)
 {
 	ChunkScalar rx = x / REGION_SIZE;
@@ -284,6 +517,7 @@ void World::removeChunk( long x, long y, long z )
 	ChunkScalar rz = z / REGION_SIZE;
 	Magnetite::ChunkRegionPtr r = getRegion(rx, ry, rz);
 	if( r == NULL ) return;
+	mVisibilityDirty = true;
 	return r->remove( x % REGION_SIZE, y % REGION_SIZE, z % REGION_SIZE );
 }
 
@@ -292,40 +526,271 @@ bool World::hasNeighbours(short int x, short int y, short int z)
 	return false;
 }
 
+size_t World::_chunkJobKey( ChunkScalar x, ChunkScalar y, ChunkScalar z )
+{
+	size_t edge = mWorldSize * REGION_SIZE;
+	return ( z * edge * edge + y * edge + x );
+}
+
+bool World::isPotentiallyVisible( Chunk* chunk )
+{
+	uint32_t stamp = mVisibilityStamp;
+	if( stamp == 0 ) return true;
+	
+	// Chunks reached by the pass before count too, the current one may
+	// still be stamping.
+	uint32_t chunkStamp = chunk->_getVisibleStamp();
+	return chunkStamp != 0 && chunkStamp + 1 >= stamp;
+}
+
+bool World::isMeshWanted( Chunk* chunk )
+{
+	if( isPotentiallyVisible( chunk ) ) return true;
+	
+	return std::abs( chunk->getX() - mVisibilityX ) <= 1
+		&& std::abs( chunk->getY() - mVisibilityY ) <= 1
+		&& std::abs( chunk->getZ() - mVisibilityZ ) <= 1;
+}
+
+bool World::isLodWanted( Chunk* chunk )
+{
+	Renderer* renderer = CoreSingleton != NULL ? CoreSingleton->getRenderer() : NULL;
+	if( mCameras.empty() || renderer == NULL ) return true;
+	
+	// A chunk's width inside the first band, so the meshes are ready as
+	// the camera moves away.
+	Vector3 eye = mCameras.front()->getPosition();
+	Vector3 center( ( chunk->getX() + 0.5f ) * CHUNK_WIDTH, ( chunk->getY() + 0.5f ) * CHUNK_HEIGHT, ( chunk->getZ() + 0.5f ) * CHUNK_WIDTH );
+	return glm::length( center - eye ) > renderer->getLodDistance( 1 ) - CHUNK_WIDTH;
+}
+
+void World::_invalidateVisibility()
+{
+	mVisibilityDirty = true;
+}
+
+void World::_updateVisibility()
+{
+	if( mCameras.empty() ) return;
+	
+	Vector3 eye = mCameras.front()->getPosition();
+	ChunkScalar cx = std::floor( eye.x / CHUNK_WIDTH );
+	ChunkScalar cy = std::floor( eye.y / CHUNK_HEIGHT );
+	ChunkScalar cz = std::floor( eye.z / CHUNK_WIDTH );
+	if( !mVisibilityDirty && cx == mVisibilityX && cy == mVisibilityY && cz == mVisibilityZ ) return;
+	
+	mVisibilityDirty = false;
+	mVisibilityX = cx;
+	mVisibilityY = cy;
+	mVisibilityZ = cz;
+	
+	// Outside of the loaded world nothing can be ruled out.
+	Chunk* origin = getChunk( cx, cy, cz );
+	if( origin == nullptr )
+	{
+		mVisibilityStamp = 0;
+		return;
+	}
+	
+	// Steps along each face, in FACE_INDEX_* order. Opposite faces differ
+	// only in the lowest bit.
+	static const ChunkScalar stepX[FACE_COUNT] = { 0, 0, -1, 1, 0, 0 };
+	static const ChunkScalar stepY[FACE_COUNT] = { 1, -1, 0, 0, 0, 0 };
+	static const ChunkScalar stepZ[FACE_COUNT] = { 0, 0, 0, 0, -1, 1 };
+	
+	struct VisibilityStep
+	{
+		Chunk* chunk;
+		// Face the step entered the chunk through, -1 for the camera's chunk.
+		int entry;
+		// Directions travelled so far, the fill never turns back.
+		uint8_t directions;
+	};
+	
+	uint32_t stamp = mVisibilityStamp + 1;
+	if( stamp == 0 ) stamp = 1;
+	
+	const size_t edge = mWorldSize * REGION_SIZE;
+	mVisibilityVisited.assign( edge * edge * edge, false );
+	
+	std::vector<VisibilityStep> queue;
+	VisibilityStep start = { origin, -1, 0 };
+	queue.push_back( start );
+	mVisibilityVisited[ ( cz * edge + cy ) * edge + cx ] = true;
+	
+	for( size_t head = 0; head < queue.size(); head++ )
+	{
+		VisibilityStep step = queue[head];
+		Chunk* c = step.chunk;
+		c->_setVisibleStamp( stamp );
+		
+		for( int face = 0; face < FACE_COUNT; face++ )
+		{
+			if( step.directions & ( 1 << ( face ^ 1 ) ) ) continue;
+			if( step.entry != -1 && !c->isConnected( step.entry, face ) ) continue;
+			
+			ChunkScalar nx = c->getX() + stepX[face];
+			ChunkScalar ny = c->getY() + stepY[face];
+			ChunkScalar nz = c->getZ() + stepZ[face];
+			if( nx < 0 || ny < 0 || nz < 0 || nx >= (ChunkScalar)edge || ny >= (ChunkScalar)edge || nz >= (ChunkScalar)edge ) continue;
+			
+			size_t bit = ( nz * edge + ny ) * edge + nx;
+			if( mVisibilityVisited[bit] ) continue;
+			mVisibilityVisited[bit] = true;
+			
+			// Chunks that aren't loaded can't be drawn, the pass runs again
+			// once they are.
+			Chunk* next = getChunk( nx, ny, nz );
+			if( next == nullptr ) continue;
+			
+			VisibilityStep nextStep = { next, face ^ 1, (uint8_t)( step.directions | ( 1 << face ) ) };
+			queue.push_back( nextStep );
+		}
+	}
+	
+	mVisibilityStamp = stamp;
+}
+
+void World::requestMesh( Chunk* chunk, const std::shared_ptr<Magnetite::ChunkNeighbourhood>& hood, bool lods )
+{
+	std::shared_ptr<BaseTriangulator> triangulator = mTriangulator;
+	mJobPool->submit( [chunk, triangulator, hood, lods]() { chunk->generate( triangulator.get(), *hood, lods ); } );
+}
+
 void World::activateChunk( long x, long y, long z )
 {
-	// Generate or load the chunk as it is not loaded.
-	if( !mSerializer->loadChunk( x, y, z ) )
+	if( x < 0 || y < 0 || z < 0 ) return;
+	
+	size_t key = _chunkJobKey( x, y, z );
+	if( mChunkJobs.find( key ) != mChunkJobs.end() ) return;
+	
+	ChunkJobPtr job( new ChunkJob( x, y, z ) );
+	mChunkJobs[key] = job;
+	mJobPool->submit( [this, job]() { _runChunkJob( job ); } );
+}
+
+void World::_runChunkJob( const ChunkJobPtr& job )
+{
+	if( !job->cancelled )
 	{
-		generateChunk( x, y, z );
+		Chunk* c = new Chunk( ChunkIndex{ job->x, job->y, job->z }, this );
+		c->_raiseChunkFlag( Chunk::Detached );
+		
+		// Generate or load the chunk as it is not loaded.
+		Magnetite::WorldSerializer::LoadResult result = mSerializer->loadChunk( c );
+		if( result == Magnetite::WorldSerializer::Corrupt )
+		{
+			Util::log( "Chunk " + Util::toString( job->x ) + "." + Util::toString( job->y ) + "." + Util::toString( job->z ) + " is corrupt, generating it again", Util::Warning );
+		}
+		if( result != Magnetite::WorldSerializer::Loaded )
+		{
+			mGenerator->fillChunk( c );
+			
+			// The chunk isn't lit here, a detached chunk has no neighbours so
+			// every column would be open sky. It is lit with its neighbours
+			// once published.
+			
+			// Generated chunks can be generated again, only save them once changed.
+			c->_markSaved( c->getGeneration() );
+		}
+		
+		job->chunk = c;
+	}
+	
+	mCompletedMutex.lock();
+	mCompletedJobs.push_back( job );
+	mCompletedMutex.unlock();
+}
+
+void World::_publishChunks()
+{
+	ChunkJobList completed;
+	mCompletedMutex.lock();
+	completed.swap( mCompletedJobs );
+	mCompletedMutex.unlock();
+	
+	for( auto it = completed.begin(); it != completed.end(); ++it )
+	{
+		ChunkJobPtr job = *it;
+		
+		// Cancelled jobs have already been replaced or forgotten.
+		if( job->cancelled ) continue;
+		
+		Magnetite::ChunkRegionPtr r = getRegion( job->x / REGION_SIZE, job->y / REGION_SIZE, job->z / REGION_SIZE );
+		ChunkScalar cx = job->x % REGION_SIZE;
+		ChunkScalar cy = job->y % REGION_SIZE;
+		ChunkScalar cz = job->z % REGION_SIZE;
+		
+		// Anything placed into the page while it was in flight is replaced,
+		// but not while its mesh is being built; try again next update.
+		Chunk* existing = r != NULL ? r->get( cx, cy, cz ) : nullptr;
+		if( existing != nullptr && existing->isMeshing() )
+		{
+			mCompletedMutex.lock();
+			mCompletedJobs.push_back( job );
+			mCompletedMutex.unlock();
+			continue;
+		}
+		
+		mChunkJobs.erase( _chunkJobKey( job->x, job->y, job->z ) );
+		if( r == NULL ) continue;
+		
+		if( existing != nullptr )
+		{
+			r->remove( cx, cy, cz );
+		}
+		
+		Chunk* c = job->chunk;
+		job->chunk = nullptr;
+		c->_lowerChunkFlag( Chunk::Detached );
+		c->_raiseChunkFlag( Chunk::DataUpdated );
+		r->set( c, cx, cy, cz );
+		mVisibilityDirty = true;
+		
+		updateAdjacent( job->x, job->y, job->z );
 	}
-	updateAdjacent(x, y, z);
 }
 
-void World::deactivateChunk( long x, long y, long z )
+bool World::deactivateChunk( long x, long y, long z )
 {
-	mSerializer->saveChunk( x, y, z );
+	// If the chunk is still being loaded, throw the result away.
+	auto it = mChunkJobs.find( _chunkJobKey( x, y, z ) );
+	if( it != mChunkJobs.end() )
+	{
+		it->second->cancelled = true;
+		mChunkJobs.erase( it );
+		return true;
+	}
+	
+	// Keep the chunk loaded rather than wait for room to save it.
+	Chunk* c = getChunk( x, y, z );
+	if( c != nullptr && c->isModified() && !mSerializer->saveChunk( x, y, z, false ) )
+	{
+		return false;
+	}
 	removeChunk( x, y, z );
+	return true;
 }
 
 void World::updateAdjacent( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 {
+	// Neighbours are lit again too, their borders now have light to take in.
 	Chunk* c;
 	
 	c = getChunk( x + 1, y, z );
-	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated );
 	c = getChunk( x - 1, y, z );
-	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated );
 
 	c = getChunk( x, y + 1, z );
-	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated );
 	c = getChunk( x, y - 1, z );
-	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated );
 	
 	c = getChunk( x, y, z + 1 );
-	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated );
 	c = getChunk( x, y, z - 1 );
-	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated | Chunk::SkipLight );
+	if( c ) c->_raiseChunkFlag( Chunk::DataUpdated );
 }
 
 void World::update( float dt )
@@ -358,32 +823,95 @@ void World::update( float dt )
 	Perf::Profiler::get().begin("cu");
 	Perf::Profiler::get().end("cu");
 	
-	// Process the chunk loading queue
+	// Move any chunks the workers have finished into the world.
+	_publishChunks();
+	
+	// Process the chunk loading queue, nearest and in-view chunks first.
+	// Loads are limited by how many jobs the workers can have in flight,
+	// the chunks waiting behind them are read ahead so they load quickly.
+	// Unloads only snapshot the chunk, but still cost an encode each.
 	mWorldMutex.lock();
 	//Perf::Profiler::get().begin("qproc");
-	if( mChunkRequests.size() > 0 )
+	std::vector<ChunkRequest*> requests;
+	requests.reserve( mChunkRequests.size() );
+	for( auto it = mChunkRequests.begin(); it != mChunkRequests.end(); ++it )
 	{
-		auto &r = mChunkRequests.at(0);
+		ChunkRequest& r = it->second;
+		r.priority = getPagePriority( r.x, r.y, r.z );
+		// Unload the furthest chunks first.
+		if( r.unload ) r.priority = -r.priority;
+		requests.push_back( &r );
+	}
+	std::sort( requests.begin(), requests.end(), compareRequests );
+	
+	size_t maxJobs = mJobPool->getThreadCount() * MaxJobsPerWorker;
+	size_t unloaded = 0;
+	size_t prefetched = 0;
+	for( auto it = requests.begin(); it != requests.end(); ++it )
+	{
+		ChunkRequest r = **it;
+		size_t key = _chunkJobKey( r.x, r.y, r.z );
 		
 		if( r.unload ) {
+			// Wait for the chunk's mesh job, the request is kept until then.
+			Chunk* c = getChunk( r.x, r.y, r.z );
+			if( c != nullptr && c->isMeshing() ) continue;
+			
+			bool inFlight = mChunkJobs.find( key ) != mChunkJobs.end();
+			if( !inFlight && unloaded >= MaxUnloadsPerUpdate ) continue;
+			if( !inFlight ) unloaded++;
+			
 			Perf::Profiler::get().begin("cu");
-			this->deactivateChunk( r.x, r.y, r.z );
+			bool deactivated = this->deactivateChunk( r.x, r.y, r.z );
 			Perf::Profiler::get().end("cu");
+			if( !deactivated ) continue;
 		}
 		else
 		{
+			if( mChunkJobs.size() >= maxJobs )
+			{
+				if( prefetched++ < maxJobs ) mSerializer->prefetchChunk( r.x, r.y, r.z );
+				continue;
+			}
+			
 			Perf::Profiler::get().begin("ca");
 			this->activateChunk( r.x, r.y, r.z );
 			Perf::Profiler::get().end("ca");
 		}
 		
-		mChunkRequests.pop_front();
+		mChunkRequests.erase( key );
 	}
 	
 	//Perf::Profiler::get().end("qproc");
 
 	mWorldMutex.unlock();
 	
+	// Checkpoints are spread across updates so saving never stalls a frame.
+	if( mCheckpointing )
+	{
+		_continueCheckpoint();
+	}
+	else if( mCheckpointInterval > 0.f )
+	{
+		mCheckpointTimer += dt;
+		if( mCheckpointTimer >= mCheckpointInterval )
+		{
+			mCheckpointTimer = 0.f;
+			mCheckpointing = true;
+			mCheckpointCursor = 0;
+			mCheckpointSaved = 0;
+			_continueCheckpoint();
+		}
+	}
+	
+	Perf::Profiler::get().begin("lupdate");
+	_applyBlockChanges();
+	Perf::Profiler::get().end("lupdate");
+	
+	Perf::Profiler::get().begin("pvs");
+	_updateVisibility();
+	Perf::Profiler::get().end("pvs");
+	
 	Perf::Profiler::get().begin("wthink");
 	auto wcube = mWorldSize*mWorldSize*mWorldSize;
 	for( size_t r = 0;  r < wcube; r++ )
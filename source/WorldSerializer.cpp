@@ -4,26 +4,20 @@
 #include <BlockFactory.h>
 #include <Profiler.h>
 #include <Chunk.h>
+#include <RegionFile.h>
+#include <ChunkCodec.h>
+#include <MappedFile.h>
+#include <algorithm>
 
 namespace Magnetite
 {
-	struct ChunkHeader
-	{
-		uint32_t tCount;
-	};
-	
-	struct ChunkData
-	{
-		uint32_t blockData[CHUNK_SIZE];
-		LightIndex lightData[CHUNK_SIZE];
-		
-	};
-	
 	static std::map<Magnetite::String, size_t> tmap;
 	static std::map<size_t,Magnetite::String> idmap;
+	static std::map<size_t,BaseBlock*> typemap;
 	
 	WorldSerializer::WorldSerializer( World* w )
-	: mWorld( w )
+	: mWorld( w ),
+	mRunning( true )
 	{
 		mWorldPath = "./worlds/" + mWorld->getName();
 		
@@ -39,30 +33,86 @@ namespace Magnetite
 			auto s = it->first.c_str();
 			tmap[it->first] = ind;
 			idmap[ind] = it->first;
+			typemap[ind] = it->second->getBlockType();
 		}
 		
+		mIOThread = std::thread( &WorldSerializer::_ioWork, this );
 	}
 	
 	WorldSerializer::~WorldSerializer()
 	{
+		mIOMutex.lock();
+		mRunning = false;
+		mIOMutex.unlock();
+		mIOCondition.notify_all();
+		mIOThread.join();
 		
+		for( auto it = mRegionFiles.begin(); it != mRegionFiles.end(); ++it )
+		{
+			delete it->second;
+		}
 	}
 	
 	String WorldSerializer::resolveRegion( ChunkScalar x, ChunkScalar y, ChunkScalar z )
+	{
+		return  "./worlds/" + mWorld->getName() + "/region" + Util::toString(x) + "." + Util::toString(y) + "." + Util::toString(z);
+	}
+	
+	String WorldSerializer::resolveChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 	{
 		return  "./worlds/" + mWorld->getName() + "/chunk" + Util::toString(x) + "." + Util::toString(y) + "." + Util::toString(z);
 	}
 	
+	RegionFile* WorldSerializer::_getRegionFile( ChunkScalar x, ChunkScalar y, ChunkScalar z, bool create )
+	{
+		String path = resolveRegion( x / REGION_SIZE, y / REGION_SIZE, z / REGION_SIZE );
+		
+		std::lock_guard<std::mutex> lock( mRegionMutex );
+		auto it = mRegionFiles.find( path );
+		if( it != mRegionFiles.end() ) return it->second;
+		
+		RegionFile* file = new RegionFile();
+		if( !file->open( path, create ) )
+		{
+			delete file;
+			return nullptr;
+		}
+		
+		mRegionFiles[path] = file;
+		return file;
+	}
+	
 	bool WorldSerializer::hasChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 	{
-		std::ifstream stream( resolveRegion( x, y, z ).c_str(), std::ios::binary );
+		{
+			std::lock_guard<std::mutex> lock( mIOMutex );
+			ChunkKey key( x, y, z );
+			if( mPendingWrites.find( key ) != mPendingWrites.end() || mReadAhead.find( key ) != mReadAhead.end() ) return true;
+		}
+		
+		RegionFile* file = _getRegionFile( x, y, z, false );
+		if( file != nullptr && file->hasChunk( RegionFile::chunkIndex( x, y, z ) ) ) return true;
+		
+		std::ifstream stream( resolveChunk( x, y, z ).c_str(), std::ios::binary );
 		return stream.is_open();
 	}
 	
+	bool WorldSerializer::_readChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z, std::vector<char>& data )
+	{
+		RegionFile* file = _getRegionFile( x, y, z, false );
+		if( file != nullptr && file->readChunk( RegionFile::chunkIndex( x, y, z ), data ) ) return true;
+		
+		// Fall back to the old one file per chunk layout.
+		MappedFile legacy;
+		if( !legacy.open( resolveChunk( x, y, z ) ) ) return false;
+		
+		data.assign( legacy.getData(), legacy.getData() + legacy.getSize() );
+		return true;
+	}
+	
 	bool WorldSerializer::loadChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 	{
-		std::ifstream stream( resolveRegion(x, y, z).c_str() );
-		if( !stream.is_open() ) return false;
+		if( !hasChunk( x, y, z ) ) return false;
 		
 		auto c = mWorld->getChunk( x, y, z );
 		if( c == nullptr ) 
@@ -70,61 +120,282 @@ namespace Magnetite
 			c = mWorld->createChunk( x, y, z );
 		}
 		
-		ChunkData d;
-		stream.read( (char*)&d, sizeof(ChunkData) );
-		
-		stream.close();
+		return loadChunk( c ) == Loaded;
+	}
+	
+	WorldSerializer::LoadResult WorldSerializer::loadChunk( Chunk* c )
+	{
+		ChunkKey key( c->getX(), c->getY(), c->getZ() );
+		ChunkSnapshot snapshot;
+		{
+			// Pending saves are newer than anything on disk.
+			std::lock_guard<std::mutex> lock( mIOMutex );
+			auto it = mPendingWrites.find( key );
+			if( it != mPendingWrites.end() )
+			{
+				snapshot = it->second;
+			}
+			else
+			{
+				auto ahead = mReadAhead.find( key );
+				if( ahead != mReadAhead.end() )
+				{
+					snapshot = ahead->second.snapshot;
+					_dropReadAhead( ahead );
+				}
+			}
+		}
 		
-		Perf::Profiler::get().begin("dread");
-		size_t id;
-		LightIndex lv;
-		for( int i = 0; i < CHUNK_SIZE; i++ )
+		if( snapshot )
 		{
-			id = d.blockData[i];
-			lv = d.lightData[i];
-			if( id != 0 )
+			if( !_decodeChunk( c, snapshot->data(), snapshot->size() ) ) return Corrupt;
+		}
+		else
+		{
+			// Decode straight from the mapped file rather than copying it.
+			bool decoded = false;
+			auto reader = [this, c, &decoded]( const char* data, size_t length ) {
+				decoded = _decodeChunk( c, data, length );
+				return true;
+			};
+			
+			RegionFile* file = _getRegionFile( c->getX(), c->getY(), c->getZ(), false );
+			bool stored = file != nullptr && file->readChunk( RegionFile::chunkIndex( c->getX(), c->getY(), c->getZ() ), reader );
+			if( !decoded )
 			{
-				auto block = FactoryManager::getManager().createBlock(idmap[id]);
-				if( block != nullptr )
-					c->setBlockAt( block, i );
+				// Fall back to the old one file per chunk layout, a chunk that
+				// couldn't be decoded is still empty.
+				MappedFile legacy;
+				if( !legacy.open( resolveChunk( c->getX(), c->getY(), c->getZ() ) ) ) return stored ? Corrupt : NotStored;
+				reader( legacy.getData(), legacy.getSize() );
+				if( !decoded ) return Corrupt;
 			}
-			c->setLightLevel( lv, i );
 		}
 		
 		c->_raiseChunkFlag( Chunk::SkipLight );
+		c->_markSaved( c->getGeneration() );
+		
+		return Loaded;
+	}
+	
+	bool WorldSerializer::_decodeChunk( Chunk* c, const char* data, size_t length )
+	{
+		Perf::Profiler::get().begin("dread");
+		
+		auto blocks = [c]( size_t start, size_t count, uint32_t id ) {
+			if( id == 0 ) return;
+			// find() rather than [], this runs on several threads at once.
+			auto type = typemap.find( id );
+			if( type == typemap.end() || type->second == nullptr ) return;
+			BaseBlock* block = type->second;
+			bool stateful = block->hasState();
+			for( size_t i = start; i < start + count; i++ )
+			{
+				if( stateful ) block = FactoryManager::getManager().createBlock( idmap.find( id )->second );
+				c->setBlockAt( block, i );
+			}
+		};
+		auto light = [c]( size_t start, size_t count, uint32_t level ) {
+			for( size_t i = start; i < start + count; i++ )
+			{
+				c->setLightLevel( level, i );
+			}
+		};
+		
+		// Check the whole chunk before touching it, decoding can fail part
+		// way through the runs.
+		auto ignore = []( size_t, size_t, uint32_t ) {};
+		bool decoded = ChunkCodec::decode( data, length, ignore, ignore );
+		if( decoded )
+		{
+			ChunkCodec::decode( data, length, blocks, light );
+		}
+		else
+		{
+			Util::log( "Chunk data is invalid, ignoring it", Util::Warning );
+		}
 		
 		Perf::Profiler::get().end("dread");
 		
-		return true;
+		return decoded;
 	}
 	
-	void WorldSerializer::saveChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z )
+	bool WorldSerializer::saveChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z, bool wait )
 	{
 		auto c = mWorld->getChunk( x, y, z );
-		if( c == nullptr || c->getBlockCount() == 0 ) 
+		if( c == nullptr ) 
 		{
-			return;
+			return false;
 		}
-	
-		std::ofstream stream( resolveRegion(x, y, z).c_str() );
 		
-		ChunkData d;
+		ChunkKey key( x, y, z );
+		if( !wait )
+		{
+			// Only the caller adds snapshots, so the buffer can't fill up
+			// again while the chunk is encoded.
+			std::lock_guard<std::mutex> lock( mIOMutex );
+			if( mPendingWrites.size() >= MaxPendingWrites && mPendingWrites.find( key ) == mPendingWrites.end() ) return false;
+		}
 		
+		// Empty chunks are stored too, so a chunk that was dug out isn't
+		// generated again. The codec keeps them to a few bytes.
+		uint32_t generation = c->getGeneration();
+		std::vector<uint32_t> ids( CHUNK_SIZE );
+		std::vector<LightIndex> light( CHUNK_SIZE );
+		
+		// Neighbouring blocks are usually the same type, so remember the last
+		// lookup rather than searching the type map for every block.
+		BaseBlock* lastBlock = nullptr;
+		uint32_t lastId = 0;
 		for( int i = 0; i < CHUNK_SIZE; i++ )
 		{
 			auto b = c->getBlockAt(i);
-			if( b != nullptr ) {
-				d.blockData[i] = tmap[b->getType()];
+			if( b != nullptr && b != lastBlock ) {
+				lastBlock = b;
+				lastId = tmap[b->getType()];
 			}
-			else
-			{
-				d.blockData[i] = 0;
-			}
-			d.lightData[i] = c->getLightLevel( i );
+			ids[i] = b != nullptr ? lastId : 0;
+			light[i] = c->getLightLevel( i );
 		}
 		
-		stream.write( (char*)&d , sizeof(d) );
+		ChunkSnapshot snapshot( new std::vector<char>() );
+		ChunkCodec::encode( ids.data(), light.data(), *snapshot );
+		c->_markSaved( generation );
+		
+		std::unique_lock<std::mutex> lock( mIOMutex );
+		
+		// Wait for room in the buffer, replacing a pending snapshot doesn't need any.
+		while( mPendingWrites.size() >= MaxPendingWrites && mPendingWrites.find( key ) == mPendingWrites.end() )
+		{
+			mWrittenCondition.wait( lock );
+		}
+		
+		mPendingWrites[key] = snapshot;
+		auto ahead = mReadAhead.find( key );
+		if( ahead != mReadAhead.end() ) _dropReadAhead( ahead );
+		if( std::find( mWriteQueue.begin(), mWriteQueue.end(), key ) == mWriteQueue.end() )
+		{
+			mWriteQueue.push_back( key );
+		}
+		lock.unlock();
+		mIOCondition.notify_one();
+		
+		return true;
+	}
+	
+	void WorldSerializer::prefetchChunk( ChunkScalar x, ChunkScalar y, ChunkScalar z )
+	{
+		ChunkKey key( x, y, z );
+		{
+			std::lock_guard<std::mutex> lock( mIOMutex );
+			if( mPendingWrites.find( key ) != mPendingWrites.end() || mReadAhead.find( key ) != mReadAhead.end() ) return;
+			if( std::find( mPrefetchQueue.begin(), mPrefetchQueue.end(), key ) != mPrefetchQueue.end() ) return;
+			mPrefetchQueue.push_back( key );
+		}
+		mIOCondition.notify_one();
+	}
+	
+	void WorldSerializer::flush()
+	{
+		std::unique_lock<std::mutex> lock( mIOMutex );
+		while( !mPendingWrites.empty() )
+		{
+			mWrittenCondition.wait( lock );
+		}
+	}
+	
+	size_t WorldSerializer::getPendingWriteCount()
+	{
+		std::lock_guard<std::mutex> lock( mIOMutex );
+		return mPendingWrites.size();
+	}
+	
+	void WorldSerializer::_writeChunk( const ChunkKey& key, const ChunkSnapshot& snapshot )
+	{
+		ChunkScalar x = std::get<0>( key ), y = std::get<1>( key ), z = std::get<2>( key );
 		
-		stream.close();
+		RegionFile* file = _getRegionFile( x, y, z, true );
+		if( file == nullptr || !file->writeChunk( RegionFile::chunkIndex( x, y, z ), snapshot->data(), snapshot->size() ) )
+		{
+			Util::log( "Failed to save chunk " + Util::toString(x) + "." + Util::toString(y) + "." + Util::toString(z), Util::Error );
+		}
+	}
+	
+	void WorldSerializer::_dropReadAhead( ReadAheadMap::iterator it )
+	{
+		mReadAheadOrder.erase( it->second.order );
+		mReadAhead.erase( it );
+	}
+	
+	void WorldSerializer::_ioWork()
+	{
+		std::unique_lock<std::mutex> lock( mIOMutex );
+		while( true )
+		{
+			while( mRunning && mWriteQueue.empty() && mPrefetchQueue.empty() )
+			{
+				mIOCondition.wait( lock );
+			}
+			
+			if( !mWriteQueue.empty() )
+			{
+				// Write everything queued as one batch, ordered so chunks in the
+				// same region file are written together.
+				std::vector<ChunkKey> batch( mWriteQueue.begin(), mWriteQueue.end() );
+				mWriteQueue.clear();
+				std::sort( batch.begin(), batch.end(), []( const ChunkKey& a, const ChunkKey& b ) {
+					return std::make_tuple( std::get<0>( a ) / REGION_SIZE, std::get<1>( a ) / REGION_SIZE, std::get<2>( a ) / REGION_SIZE, a )
+						< std::make_tuple( std::get<0>( b ) / REGION_SIZE, std::get<1>( b ) / REGION_SIZE, std::get<2>( b ) / REGION_SIZE, b );
+				} );
+				
+				std::vector<ChunkSnapshot> snapshots;
+				for( auto it = batch.begin(); it != batch.end(); ++it )
+				{
+					snapshots.push_back( mPendingWrites[*it] );
+				}
+				
+				lock.unlock();
+				for( size_t i = 0; i < batch.size(); i++ )
+				{
+					_writeChunk( batch[i], snapshots[i] );
+				}
+				lock.lock();
+				
+				// Keep snapshots that were replaced while writing, they're queued again.
+				for( size_t i = 0; i < batch.size(); i++ )
+				{
+					auto it = mPendingWrites.find( batch[i] );
+					if( it != mPendingWrites.end() && it->second == snapshots[i] )
+					{
+						mPendingWrites.erase( it );
+					}
+				}
+				mWrittenCondition.notify_all();
+				continue;
+			}
+			
+			if( !mRunning ) return;
+			
+			ChunkKey key = mPrefetchQueue.front();
+			mPrefetchQueue.pop_front();
+			if( mPendingWrites.find( key ) != mPendingWrites.end() || mReadAhead.find( key ) != mReadAhead.end() ) continue;
+			
+			lock.unlock();
+			ChunkSnapshot snapshot( new std::vector<char>() );
+			bool found = _readChunk( std::get<0>( key ), std::get<1>( key ), std::get<2>( key ), *snapshot );
+			lock.lock();
+			
+			// Anything saved while reading is newer.
+			if( found && mPendingWrites.find( key ) == mPendingWrites.end() && mReadAhead.find( key ) == mReadAhead.end() )
+			{
+				mReadAheadOrder.push_back( key );
+				ReadAheadEntry entry = { snapshot, std::prev( mReadAheadOrder.end() ) };
+				mReadAhead[key] = entry;
+				while( mReadAheadOrder.size() > MaxReadAhead )
+				{
+					_dropReadAhead( mReadAhead.find( mReadAheadOrder.front() ) );
+				}
+			}
+		}
 	}
 };
@@ -1 +1,50 @@
-#include "BaseTriangulator.h"
\ No newline at end of file
+#include "BaseTriangulator.h"
+#include <BaseBlock.h>
+
+const float BaseTriangulator::FaceCorners[6][4][3] = {
+	{ {0, 1, 1}, {1, 1, 1}, {1, 1, 0}, {0, 1, 0} }, // Top
+	{ {0, 0, 1}, {0, 0, 0}, {1, 0, 0}, {1, 0, 1} }, // Bottom
+	{ {0, 1, 0}, {0, 0, 0}, {0, 0, 1}, {0, 1, 1} }, // Left
+	{ {1, 1, 1}, {1, 0, 1}, {1, 0, 0}, {1, 1, 0} }, // Right
+	{ {1, 1, 0}, {0, 1, 0}, {0, 0, 0}, {1, 0, 0} }, // Forward
+	{ {1, 1, 1}, {0, 1, 1}, {0, 0, 1}, {1, 0, 1} }  // Back
+};
+
+/**
+ * Direction each face points, in FACE_INDEX_ order.
+ */
+static const int faceNormals[FACE_COUNT][3] = {
+	{ 0, 1, 0 }, { 0, -1, 0 },
+	{ -1, 0, 0 }, { 1, 0, 0 },
+	{ 0, 0, -1 }, { 0, 0, 1 }
+};
+
+uint8_t BaseTriangulator::faceOcclusion( const Magnetite::ChunkNeighbourhood& hood, long x, long y, long z, int face )
+{
+	int axis = faceNormals[face][0] != 0 ? 0 : ( faceNormals[face][1] != 0 ? 1 : 2 );
+	int uAxis = ( axis + 1 ) % 3, vAxis = ( axis + 2 ) % 3;
+	
+	uint8_t ao = 0;
+	for( int c = 0; c < 4; c++ )
+	{
+		// The three blocks touching the corner in the layer the face looks into.
+		long side[3] = { x + faceNormals[face][0], y + faceNormals[face][1], z + faceNormals[face][2] };
+		long du = FaceCorners[face][c][uAxis] > 0.5f ? 1 : -1;
+		long dv = FaceCorners[face][c][vAxis] > 0.5f ? 1 : -1;
+		
+		long a[3] = { side[0], side[1], side[2] };
+		a[uAxis] += du;
+		long b[3] = { side[0], side[1], side[2] };
+		b[vAxis] += dv;
+		long d[3] = { a[0], a[1], a[2] };
+		d[vAxis] += dv;
+		
+		int s1 = hood.isOpaque( a[0], a[1], a[2] );
+		int s2 = hood.isOpaque( b[0], b[1], b[2] );
+		int corner = hood.isOpaque( d[0], d[1], d[2] );
+		int occlusion = ( s1 && s2 ) ? 3 : s1 + s2 + corner;
+		
+		ao |= occlusion << ( c * 2 );
+	}
+	return ao;
+}
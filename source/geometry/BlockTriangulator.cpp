@@ -17,13 +17,15 @@
 	vert.l = (GLubyte)(l*255);
 */
 
-#define VERTEX( fn, xp, yp, zp, up, vp, lp ) \
+#define VERTEX( fn, xp, yp, zp, face, lp ) \
 	data[ind + fn].x = pos.x + xp; \
 	data[ind + fn].y = pos.y + yp; \
 	data[ind + fn].z = pos.z + zp; \
-	data[ind + fn].u0 = up; \
-	data[ind + fn].v0 = vp; \
-	data[ind + fn].l = lp*255.f;
+	data[ind + fn].u0 = rect.x; \
+	data[ind + fn].v0 = rect.y; \
+	data[ind + fn].l = lp*255.f; \
+	data[ind + fn].f = face; \
+	data[ind + fn].ao = ( ao >> ( fn * 2 ) ) & 3;
 
 // These are here for reference & eveuntually some cleaner code.
 /*static float face_vertices[] = {
@@ -46,7 +48,19 @@ static size_t face_indicies[] = {
 	0, 1, 4,	4, 1, 5  // Bottom
 };*/
 
-void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk )
+/**
+ * Moves each of a quad's edges on by one corner, splitting it along its
+ * other diagonal with the same winding.
+ */
+static inline void turnQuad( GLedge* edges, size_t base )
+{
+	for( int e = 0; e < 6; e++ )
+	{
+		edges[e] = base + ( edges[e] - base + 1 ) % 4;
+	}
+}
+
+void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood )
 {
 	// Prepare the geometry
 	GLuint numVerts = chunk->getVisibleFaceCount() * 4;
@@ -72,42 +86,42 @@ void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk )
 	
 	auto data = geom->vertexData;
 	auto edges = geom->edgeData;
-	ChunkScalar cx = (chunk->getX() * CHUNK_WIDTH), cy = (chunk->getY() * CHUNK_WIDTH), cz = (chunk->getZ() * CHUNK_WIDTH);
 	auto tm = MagnetiteCore::Singleton->getTextureManager();
-	auto w = chunk->getWorld();
 	auto &vb = chunk->getVisibleBlocks();
 	
-	ChunkScalar wx, wy, wz;
 	short texX, texY;
 	short visFlags;
 	Vector3 pos;
 	GLuvrect rect;
+	uint8_t ao;
 	
 	BaseBlock* b;
 	
-	for( BlockList::iterator it = vb.begin(); it != vb.end(); ++it )
+	for( size_t i = 0; i < vb.size(); i++ )
 	{
-		pos = Util::indexToPosition( it->first );
-		b = it->second;
+		pos = Util::indexToPosition( vb.indices[i] );
+		b = hood.getBlock( pos.x, pos.y, pos.z );
+		if( b == NULL ) continue;
 		
-		wx = cx + pos.x; wy = cy + pos.y; wz = cz + pos.z;
 		texX = 0, texY = 0;
-		visFlags = it->second->getVisFlags();
+		visFlags = vb.faces[i];
 			
 		/* Face -Z */
 		if((visFlags & FACE_BACK) == FACE_BACK ) {
 			b->getTextureCoords( FACE_BACK, texX, texY );
 			rect = tm->getBlockUVs( texX, texY );
 			
-			float color = World::getLightColor( w->getLightLevel( wx, wy, wz+1 ) );
+			float color = World::getLightColor( hood.getLight( pos.x, pos.y, pos.z+1 ) );
+			ao = faceOcclusion( hood, pos.x, pos.y, pos.z, FACE_INDEX_BACK );
 			
-			VERTEX( 0, 1.0f, 1.0f, 1.0f, rect.x,          rect.y,          color )
-			VERTEX( 1, 0.0f, 1.0f, 1.0f, rect.x + rect.w, rect.y,          color )
-			VERTEX( 2, 0.0f, 0.0f, 1.0f, rect.x + rect.w, rect.y + rect.h, color )
-			VERTEX( 3, 1.0f, 0.0f, 1.0f, rect.x,          rect.y + rect.h, color )
+			VERTEX( 0, 1.0f, 1.0f, 1.0f, FACE_INDEX_BACK, color )
+			VERTEX( 1, 0.0f, 1.0f, 1.0f, FACE_INDEX_BACK, color )
+			VERTEX( 2, 0.0f, 0.0f, 1.0f, FACE_INDEX_BACK, color )
+			VERTEX( 3, 1.0f, 0.0f, 1.0f, FACE_INDEX_BACK, color )
 			
 			edges[eInd + 0] = ind + 2; edges[eInd + 1] = ind + 1; edges[eInd + 2] = ind + 0;
 			edges[eInd + 3] = ind + 2; edges[eInd + 4] = ind + 0; edges[eInd + 5] = ind + 3;
+			if( flipQuad( ao ) ) turnQuad( edges + eInd, ind );
 			eInd += 6;
 			ind += 4;
 		}
@@ -116,15 +130,17 @@ void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk )
 			b->getTextureCoords( FACE_FORWARD, texX, texY );
 			rect = tm->getBlockUVs( texX, texY );
 
-			float color = World::getLightColor( w->getLightLevel( wx, wy, wz-1 ) );
+			float color = World::getLightColor( hood.getLight( pos.x, pos.y, pos.z-1 ) );
+			ao = faceOcclusion( hood, pos.x, pos.y, pos.z, FACE_INDEX_FORWARD );
 			
-			VERTEX( 0, 1.0f, 1.0f, 0.0f, rect.x,          rect.y,          color )
-			VERTEX( 1, 0.0f, 1.0f, 0.0f, rect.x + rect.w, rect.y,          color )
-			VERTEX( 2, 0.0f, 0.0f, 0.0f, rect.x + rect.w, rect.y + rect.h, color )
-			VERTEX( 3, 1.0f, 0.0f, 0.0f, rect.x,          rect.y + rect.h, color )
+			VERTEX( 0, 1.0f, 1.0f, 0.0f, FACE_INDEX_FORWARD, color )
+			VERTEX( 1, 0.0f, 1.0f, 0.0f, FACE_INDEX_FORWARD, color )
+			VERTEX( 2, 0.0f, 0.0f, 0.0f, FACE_INDEX_FORWARD, color )
+			VERTEX( 3, 1.0f, 0.0f, 0.0f, FACE_INDEX_FORWARD, color )
 			
 			edges[eInd + 5] = ind + 2; edges[eInd + 4] = ind + 1; edges[eInd + 3] = ind + 0;
 			edges[eInd + 2] = ind + 2; edges[eInd + 1] = ind + 0; edges[eInd + 0] = ind + 3;
+			if( flipQuad( ao ) ) turnQuad( edges + eInd, ind );
 			eInd += 6;
 			ind += 4;
 		}
@@ -133,18 +149,20 @@ void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk )
 			b->getTextureCoords( FACE_RIGHT, texX, texY );
 			rect = tm->getBlockUVs( texX, texY );
 			
-			float color = World::getLightColor( w->getLightLevel( wx+1, wy, wz ) );
+			float color = World::getLightColor( hood.getLight( pos.x+1, pos.y, pos.z ) );
+			ao = faceOcclusion( hood, pos.x, pos.y, pos.z, FACE_INDEX_RIGHT );
 
 			// + rect.w, rect.y,          color )
 			// + rect.w, rect.y + rect.h, color )
 			//          rect.y + rect.h, color )
-			VERTEX( 0, 1.0f, 1.0f, 1.0f, rect.x,          rect.y,          color )
-			VERTEX( 1, 1.0f, 0.0f, 1.0f, rect.x,          rect.y + rect.h, color )
-			VERTEX( 2, 1.0f, 0.0f, 0.0f, rect.x + rect.w, rect.y + rect.h, color )
-			VERTEX( 3, 1.0f, 1.0f, 0.0f, rect.x + rect.w, rect.y,          color )
+			VERTEX( 0, 1.0f, 1.0f, 1.0f, FACE_INDEX_RIGHT, color )
+			VERTEX( 1, 1.0f, 0.0f, 1.0f, FACE_INDEX_RIGHT, color )
+			VERTEX( 2, 1.0f, 0.0f, 0.0f, FACE_INDEX_RIGHT, color )
+			VERTEX( 3, 1.0f, 1.0f, 0.0f, FACE_INDEX_RIGHT, color )
 			
 			edges[eInd + 0] = ind + 2; edges[eInd + 1] = ind + 1; edges[eInd + 2] = ind + 0;
 			edges[eInd + 3] = ind + 2; edges[eInd + 4] = ind + 0; edges[eInd + 5] = ind + 3;
+			if( flipQuad( ao ) ) turnQuad( edges + eInd, ind );
 			eInd += 6;
 			ind += 4;
 		}
@@ -153,15 +171,17 @@ void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk )
 			b->getTextureCoords( FACE_BOTTOM, texX, texY );
 			rect = tm->getBlockUVs( texX, texY );
 
-			float color = World::getLightColor( w->getLightLevel( wx, wy-1, wz ) );
+			float color = World::getLightColor( hood.getLight( pos.x, pos.y-1, pos.z ) );
+			ao = faceOcclusion( hood, pos.x, pos.y, pos.z, FACE_INDEX_BOTTOM );
 			
-			VERTEX( 0, 0.0f, 0.0f, 1.0f, rect.x,          rect.y,          color )
-			VERTEX( 1, 0.0f, 0.0f, 0.0f, rect.x + rect.w, rect.y,          color )
-			VERTEX( 2, 1.0f, 0.0f, 0.0f, rect.x + rect.w, rect.y + rect.h, color )
-			VERTEX( 3, 1.0f, 0.0f, 1.0f, rect.x,          rect.y + rect.h, color )
+			VERTEX( 0, 0.0f, 0.0f, 1.0f, FACE_INDEX_BOTTOM, color )
+			VERTEX( 1, 0.0f, 0.0f, 0.0f, FACE_INDEX_BOTTOM, color )
+			VERTEX( 2, 1.0f, 0.0f, 0.0f, FACE_INDEX_BOTTOM, color )
+			VERTEX( 3, 1.0f, 0.0f, 1.0f, FACE_INDEX_BOTTOM, color )
 			
 			edges[eInd + 0] = ind + 2; edges[eInd + 1] = ind + 1; edges[eInd + 2] = ind + 0;
 			edges[eInd + 3] = ind + 2; edges[eInd + 4] = ind + 0; edges[eInd + 5] = ind + 3;
+			if( flipQuad( ao ) ) turnQuad( edges + eInd, ind );
 			eInd += 6;
 			ind += 4;
 		}
@@ -170,15 +190,17 @@ void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk )
 			b->getTextureCoords( FACE_TOP, texX, texY );
 			rect = tm->getBlockUVs( texX, texY );
 
-			float color = World::getLightColor( w->getLightLevel( wx, wy+1, wz ) );
+			float color = World::getLightColor( hood.getLight( pos.x, pos.y+1, pos.z ) );
+			ao = faceOcclusion( hood, pos.x, pos.y, pos.z, FACE_INDEX_TOP );
 			
-			VERTEX( 0, 0.0f, 1.0f, 1.0f, rect.x,          rect.y,          color )
-			VERTEX( 1, 1.0f, 1.0f, 1.0f, rect.x + rect.w, rect.y,          color )
-			VERTEX( 2, 1.0f, 1.0f, 0.0f, rect.x + rect.w, rect.y + rect.h, color )
-			VERTEX( 3, 0.0f, 1.0f, 0.0f, rect.x,          rect.y + rect.h, color )
+			VERTEX( 0, 0.0f, 1.0f, 1.0f, FACE_INDEX_TOP, color )
+			VERTEX( 1, 1.0f, 1.0f, 1.0f, FACE_INDEX_TOP, color )
+			VERTEX( 2, 1.0f, 1.0f, 0.0f, FACE_INDEX_TOP, color )
+			VERTEX( 3, 0.0f, 1.0f, 0.0f, FACE_INDEX_TOP, color )
 			
 			edges[eInd + 0] = ind + 2; edges[eInd + 1] = ind + 1; edges[eInd + 2] = ind + 0;
 			edges[eInd + 3] = ind + 2; edges[eInd + 4] = ind + 0; edges[eInd + 5] = ind + 3;
+			if( flipQuad( ao ) ) turnQuad( edges + eInd, ind );
 			eInd += 6;
 			ind += 4;
 		}
@@ -187,18 +209,23 @@ void BlockTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk )
 			b->getTextureCoords( FACE_LEFT, texX, texY );
 			rect = tm->getBlockUVs( texX, texY );
 
-			float color = World::getLightColor( w->getLightLevel( wx-1, wy, wz ) );
+			float color = World::getLightColor( hood.getLight( pos.x-1, pos.y, pos.z ) );
+			ao = faceOcclusion( hood, pos.x, pos.y, pos.z, FACE_INDEX_LEFT );
 			
-			VERTEX( 0, 0.0f, 1.0f, 0.0f, rect.x,          rect.y,          color )
-			VERTEX( 1, 0.0f, 0.0f, 0.0f, rect.x,          rect.y + rect.h, color )
-			VERTEX( 2, 0.0f, 0.0f, 1.0f, rect.x + rect.w, rect.y + rect.h, color )
-			VERTEX( 3, 0.0f, 1.0f, 1.0f, rect.x + rect.w, rect.y,          color )
+			VERTEX( 0, 0.0f, 1.0f, 0.0f, FACE_INDEX_LEFT, color )
+			VERTEX( 1, 0.0f, 0.0f, 0.0f, FACE_INDEX_LEFT, color )
+			VERTEX( 2, 0.0f, 0.0f, 1.0f, FACE_INDEX_LEFT, color )
+			VERTEX( 3, 0.0f, 1.0f, 1.0f, FACE_INDEX_LEFT, color )
 			
 			edges[eInd + 0] = ind + 2; edges[eInd + 1] = ind + 1; edges[eInd + 2] = ind + 0;
 			edges[eInd + 3] = ind + 2; edges[eInd + 4] = ind + 0; edges[eInd + 5] = ind + 3;
+			if( flipQuad( ao ) ) turnQuad( edges + eInd, ind );
 			eInd += 6;
 			ind += 4;
 		}
 	}
 	
+	// Blocks removed since the last visibility pass are skipped.
+	geom->vertexCount = ind;
+	geom->edgeCount = eInd;
 }
\ No newline at end of file
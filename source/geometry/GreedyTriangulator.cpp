@@ -0,0 +1,280 @@
+#include "GreedyTriangulator.h"
+#include <Chunk.h>
+#include <BaseBlock.h>
+#include <MagnetiteCore.h>
+#include <World.h>
+#include <TextureManager.h>
+#include "Geometry.h"
+
+static const GLedge faceEdges[FACE_COUNT][6] = {
+	{ 2, 1, 0, 2, 0, 3 },
+	{ 2, 1, 0, 2, 0, 3 },
+	{ 2, 1, 0, 2, 0, 3 },
+	{ 2, 1, 0, 2, 0, 3 },
+	{ 3, 0, 2, 0, 1, 2 },
+	{ 2, 1, 0, 2, 0, 3 }
+};
+
+/**
+ * Axis each face points along, and the two axes that span it.
+ */
+static const int faceAxes[FACE_COUNT][3] = {
+	{ 1, 0, 2 }, // Top
+	{ 1, 0, 2 }, // Bottom
+	{ 0, 2, 1 }, // Left
+	{ 0, 2, 1 }, // Right
+	{ 2, 0, 1 }, // Forward
+	{ 2, 0, 1 }  // Back
+};
+
+/**
+ * Offset to the block each face looks at, for lighting.
+ */
+static const int faceNormals[FACE_COUNT][3] = {
+	{ 0, 1, 0 }, { 0, -1, 0 },
+	{ -1, 0, 0 }, { 1, 0, 0 },
+	{ 0, 0, -1 }, { 0, 0, 1 }
+};
+
+/**
+ * Index of a cell in a cube of n cells along each axis, matches
+ * BLOCK_INDEX_2 when each cell is a single block.
+ */
+static inline size_t cellIndex( const int* p, int n )
+{
+	return ( p[2] * n + p[1] ) * n + p[0];
+}
+
+GreedyTriangulator::GreedyTriangulator( int scale )
+: mScale( scale )
+{
+}
+
+void GreedyTriangulator::_maskBlocks( Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood, int face, std::vector<uint64_t>& mask )
+{
+	auto &vb = chunk->getVisibleBlocks();
+	short faceFlag = 1 << face;
+	
+	for( size_t i = 0; i < vb.size(); i++ )
+	{
+		if( ( vb.faces[i] & faceFlag ) != faceFlag ) continue;
+		
+		size_t index = vb.indices[i];
+		long x = index % CHUNK_WIDTH, y = ( index / CHUNK_WIDTH ) % CHUNK_HEIGHT, z = index / ( CHUNK_WIDTH * CHUNK_HEIGHT );
+		BlockPtr block = hood.getBlock( x, y, z );
+		if( block == NULL ) continue;
+		
+		short texX = 0, texY = 0;
+		block->getTextureCoords( faceFlag, texX, texY );
+		LightIndex light = hood.getLight( x + faceNormals[face][0], y + faceNormals[face][1], z + faceNormals[face][2] );
+		uint64_t ao = faceOcclusion( hood, x, y, z, face );
+		
+		mask[index] = ( ao << 32 ) | ( 1u << 24 ) | ( light << 16 ) | ( ( texY & 0xFF ) << 8 ) | ( texX & 0xFF );
+	}
+}
+
+void GreedyTriangulator::_maskCells( const Magnetite::ChunkNeighbourhood& hood, const std::vector<BlockPtr>& cells, int face, std::vector<uint64_t>& mask )
+{
+	short faceFlag = 1 << face;
+	int n = CHUNK_WIDTH / mScale;
+	int axis = faceAxes[face][0], uAxis = faceAxes[face][1], vAxis = faceAxes[face][2];
+	const int* normal = faceNormals[face];
+	
+	int p[3];
+	for( p[2] = 0; p[2] < n; p[2]++ )
+	{
+		for( p[1] = 0; p[1] < n; p[1]++ )
+		{
+			for( p[0] = 0; p[0] < n; p[0]++ )
+			{
+				BlockPtr cell = cells[ cellIndex( p, n ) ];
+				if( cell == NULL ) continue;
+				
+				int q[3] = { p[0] + normal[0], p[1] + normal[1], p[2] + normal[2] };
+				LightIndex light = 0;
+				if( q[axis] >= 0 && q[axis] < n )
+				{
+					if( cells[ cellIndex( q, n ) ] != NULL ) continue;
+					light = hood.getLight( q[0] * mScale + mScale / 2, q[1] * mScale + mScale / 2, q[2] * mScale + mScale / 2 );
+				}
+				else
+				{
+					// The neighbour may be drawn at any level, so keep the face
+					// if any block it covers could be seen through. This
+					// overlaps the neighbour's mesh instead of leaving a gap.
+					bool open = false;
+					long b[3];
+					b[axis] = normal[axis] > 0 ? ( p[axis] + 1 ) * mScale : p[axis] * mScale - 1;
+					for( int dv = 0; dv < mScale; dv++ )
+					{
+						b[vAxis] = p[vAxis] * mScale + dv;
+						for( int du = 0; du < mScale; du++ )
+						{
+							b[uAxis] = p[uAxis] * mScale + du;
+							if( hood.isOpaque( b[0], b[1], b[2] ) ) continue;
+							
+							open = true;
+							light = std::max( light, hood.getLight( b[0], b[1], b[2] ) );
+						}
+					}
+					if( !open ) continue;
+				}
+				
+				short texX = 0, texY = 0;
+				cell->getTextureCoords( faceFlag, texX, texY );
+				mask[ cellIndex( p, n ) ] = ( 1u << 24 ) | ( light << 16 ) | ( ( texY & 0xFF ) << 8 ) | ( texX & 0xFF );
+			}
+		}
+	}
+}
+
+void GreedyTriangulator::triangulateChunk( TerrainGeometry* geom, Chunk* chunk, const Magnetite::ChunkNeighbourhood& hood )
+{
+	std::vector<TerrainVertex> vertices;
+	std::vector<GLedge> edges;
+	vertices.reserve( chunk->getVisibleFaceCount() / ( mScale * mScale ) );
+	edges.reserve( chunk->getVisibleFaceCount() / ( mScale * mScale ) * 3 / 2 );
+	
+	auto tm = MagnetiteCore::Singleton->getTextureManager();
+	int n = CHUNK_WIDTH / mScale;
+	
+	// A cell is solid if it holds any block, it is drawn with the topmost one.
+	std::vector<BlockPtr> cells;
+	if( mScale > 1 )
+	{
+		cells.resize( n * n * n, NULL );
+		int p[3];
+		for( p[2] = 0; p[2] < n; p[2]++ )
+		{
+			for( p[1] = 0; p[1] < n; p[1]++ )
+			{
+				for( p[0] = 0; p[0] < n; p[0]++ )
+				{
+					BlockPtr cell = NULL;
+					for( int y = mScale - 1; y >= 0 && cell == NULL; y-- )
+					{
+						for( int z = 0; z < mScale && cell == NULL; z++ )
+						{
+							for( int x = 0; x < mScale && cell == NULL; x++ )
+							{
+								cell = hood.getBlock( p[0] * mScale + x, p[1] * mScale + y, p[2] * mScale + z );
+							}
+						}
+					}
+					cells[ cellIndex( p, n ) ] = cell;
+				}
+			}
+		}
+	}
+	
+	// Each face that should be drawn, keyed by everything that has to match
+	// for two faces to merge, including the occlusion of its corners so
+	// shadows stay where they fall. 0 means nothing to draw.
+	std::vector<uint64_t> mask( n * n * n );
+	
+	for( int face = 0; face < FACE_COUNT; face++ )
+	{
+		std::fill( mask.begin(), mask.end(), 0 );
+		if( mScale > 1 )
+		{
+			_maskCells( hood, cells, face, mask );
+		}
+		else
+		{
+			_maskBlocks( chunk, hood, face, mask );
+		}
+		
+		int axis = faceAxes[face][0], uAxis = faceAxes[face][1], vAxis = faceAxes[face][2];
+		int p[3];
+		for( p[axis] = 0; p[axis] < n; p[axis]++ )
+		{
+			for( int v = 0; v < n; v++ )
+			{
+				for( int u = 0; u < n; )
+				{
+					p[uAxis] = u; p[vAxis] = v;
+					uint64_t key = mask[ cellIndex( p, n ) ];
+					if( key == 0 )
+					{
+						u++;
+						continue;
+					}
+					
+					// Grow along u, then along v while every face in the row matches.
+					int width = 1;
+					for( ; u + width < n; width++ )
+					{
+						p[uAxis] = u + width;
+						if( mask[ cellIndex( p, n ) ] != key ) break;
+					}
+					
+					int height = 1;
+					for( ; v + height < n; height++ )
+					{
+						p[vAxis] = v + height;
+						bool match = true;
+						for( int du = 0; du < width && match; du++ )
+						{
+							p[uAxis] = u + du;
+							match = mask[ cellIndex( p, n ) ] == key;
+						}
+						if( !match ) break;
+					}
+					
+					for( int dv = 0; dv < height; dv++ )
+					{
+						p[vAxis] = v + dv;
+						for( int du = 0; du < width; du++ )
+						{
+							p[uAxis] = u + du;
+							mask[ cellIndex( p, n ) ] = 0;
+						}
+					}
+					
+					// Stretch the single block face over the merged area.
+					p[uAxis] = u; p[vAxis] = v;
+					GLuvrect rect = tm->getBlockUVs( key & 0xFF, ( key >> 8 ) & 0xFF );
+					float color = World::getLightColor( ( key >> 16 ) & 0xFF );
+					uint8_t ao = key >> 32;
+					GLedge base = vertices.size();
+					for( int c = 0; c < 4; c++ )
+					{
+						float corner[3] = { FaceCorners[face][c][0], FaceCorners[face][c][1], FaceCorners[face][c][2] };
+						corner[uAxis] *= width;
+						corner[vAxis] *= height;
+						
+						TerrainVertex vert;
+						vert.x = ( p[0] + corner[0] ) * mScale;
+						vert.y = ( p[1] + corner[1] ) * mScale;
+						vert.z = ( p[2] + corner[2] ) * mScale;
+						vert.u0 = rect.x;
+						vert.v0 = rect.y;
+						vert.l = color * 255.f;
+						vert.f = face;
+						vert.ao = ( ao >> ( c * 2 ) ) & 3;
+						vertices.push_back( vert );
+					}
+					// Turning the corners one step splits the quad along
+					// its other diagonal without changing the winding.
+					int turn = flipQuad( ao ) ? 1 : 0;
+					for( int e = 0; e < 6; e++ )
+					{
+						edges.push_back( base + ( faceEdges[face][e] + turn ) % 4 );
+					}
+					
+					u += width;
+				}
+			}
+		}
+	}
+	
+	delete[] geom->vertexData;
+	delete[] geom->edgeData;
+	
+	geom->vertexCount = vertices.size();
+	geom->edgeCount = edges.size();
+	geom->vertexData = new TerrainVertex[vertices.size()];
+	geom->edgeData = new GLedge[edges.size()];
+	std::copy( vertices.begin(), vertices.end(), geom->vertexData );
+	std::copy( edges.begin(), edges.end(), geom->edgeData );
+}
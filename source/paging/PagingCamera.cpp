@@ -5,6 +5,8 @@ namespace Magnetite
 {
 	PagingCamera::PagingCamera( PagingContext* ctx )
 	: mFar(50.f),
+	mDirection( 0.f, 0.f, -1.f ),
+	mViewAngle( 3.1415926f ),
 	mContext(ctx)
 	{
 		mContext->addCamera( this );
@@ -35,6 +37,39 @@ namespace Magnetite
 		return mFar;
 	}
 	
+	void PagingCamera::setDirection( const Vector3& dir )
+	{
+		mDirection = glm::normalize( dir );
+	}
+	
+	Vector3 PagingCamera::getDirection()
+	{
+		return mDirection;
+	}
+	
+	void PagingCamera::setViewAngle( float angle )
+	{
+		mViewAngle = angle;
+	}
+	
+	float PagingCamera::getViewAngle()
+	{
+		return mViewAngle;
+	}
+	
+	bool PagingCamera::isInView( const Vector3& center, float radius )
+	{
+		Vector3 v = center - mPosition;
+		float d = glm::length( v );
+		if( d <= radius ) return true;
+		
+		// Widen the cone by the angle the sphere covers.
+		float angle = mViewAngle + asin( radius / d );
+		if( angle >= 3.1415926f ) return true;
+		
+		return glm::dot( v, mDirection ) >= cos( angle ) * d;
+	}
+	
 	void PagingCamera::update()
 	{
 		auto wSize = mContext->getWorldSize();
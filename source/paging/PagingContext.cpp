@@ -110,6 +110,30 @@ namespace Magnetite
 		mNewPageMap = pm;
 	}
 	
+	/**
+	 * Distance multiplier for pages no camera is looking at.
+	 */
+	static const float OutOfViewPenalty = 4.f;
+	
+	float PagingContext::getPagePriority( ChunkScalar x, ChunkScalar y, ChunkScalar z )
+	{
+		Vector3 pagePos = Vector3( x, y, z ) * mPageSize + mPageOffset;
+		float pageRad = 0.87f * mPageSize;
+		float best = std::numeric_limits<float>::max();
+		
+		for( auto it = mCameras.begin(); it != mCameras.end(); ++it )
+		{
+			float d = glm::length( (*it)->getPosition() - pagePos );
+			if( !(*it)->isInView( pagePos, pageRad ) )
+			{
+				d *= OutOfViewPenalty;
+			}
+			best = std::min( best, d );
+		}
+		
+		return best;
+	}
+	
 	void PagingContext::pageInView( ChunkScalar x, ChunkScalar y, ChunkScalar z )
 	{
 		mNewPageMap[ ( z * mXPages * mYPages + y * mXPages + x ) ]++;
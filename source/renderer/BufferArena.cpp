@@ -0,0 +1,175 @@
+#include "BufferArena.h"
+
+namespace Magnetite
+{
+	BufferArena::BufferArena( GLenum target, size_t capacity, size_t alignment )
+	: mTarget( target ),
+	mBuffer( 0 ),
+	mCapacity( capacity - capacity % alignment ),
+	mAlignment( alignment ),
+	mMapped( NULL ),
+	mUsed( 0 )
+	{
+		glGenBuffers( 1, &mBuffer );
+		glBindBuffer( mTarget, mBuffer );
+
+#ifdef GL_ARB_buffer_storage
+		if( GLEW_ARB_buffer_storage && GLEW_ARB_sync )
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage( mTarget, mCapacity, NULL, flags );
+			mMapped = (char*)glMapBufferRange( mTarget, 0, mCapacity, flags );
+		}
+#endif
+		if( mMapped == NULL )
+		{
+			glBufferData( mTarget, mCapacity, NULL, GL_STATIC_DRAW );
+		}
+		
+		glBindBuffer( mTarget, 0 );
+		
+		mFree[0] = mCapacity;
+	}
+	
+	BufferArena::~BufferArena()
+	{
+		for( auto it = mPending.begin(); it != mPending.end(); ++it )
+		{
+			glDeleteSync( it->fence );
+		}
+		
+		if( mMapped != NULL )
+		{
+			glBindBuffer( mTarget, mBuffer );
+			glUnmapBuffer( mTarget );
+			glBindBuffer( mTarget, 0 );
+		}
+		glDeleteBuffers( 1, &mBuffer );
+	}
+	
+	bool BufferArena::allocate( size_t size, size_t& offset )
+	{
+		_reclaim();
+		
+		size = ( size + mAlignment - 1 ) / mAlignment * mAlignment;
+		if( size == 0 ) size = mAlignment;
+		
+		// First fit, the free list stays short as neighbours are merged.
+		for( auto it = mFree.begin(); it != mFree.end(); ++it )
+		{
+			if( it->second < size ) continue;
+			
+			offset = it->first;
+			size_t remaining = it->second - size;
+			mFree.erase( it );
+			if( remaining > 0 )
+			{
+				mFree[offset + size] = remaining;
+			}
+			mUsed += size;
+			return true;
+		}
+		
+		return false;
+	}
+	
+	void BufferArena::upload( size_t offset, const void* data, size_t size )
+	{
+		if( mMapped != NULL )
+		{
+			memcpy( mMapped + offset, data, size );
+		}
+		else
+		{
+			glBindBuffer( mTarget, mBuffer );
+			glBufferSubData( mTarget, offset, size, data );
+			glBindBuffer( mTarget, 0 );
+		}
+	}
+	
+	void BufferArena::free( size_t offset, size_t size )
+	{
+		size = ( size + mAlignment - 1 ) / mAlignment * mAlignment;
+		if( size == 0 ) size = mAlignment;
+		mUsed -= size;
+		
+		// glBufferSubData is ordered after earlier draws by the driver, only
+		// writes through the mapping need to wait for the GPU.
+		if( mMapped != NULL )
+		{
+			mFreed.push_back( std::make_pair( offset, size ) );
+		}
+		else
+		{
+			_release( offset, size );
+		}
+	}
+	
+	void BufferArena::endFrame()
+	{
+		if( mFreed.empty() ) return;
+		
+		PendingFree pending;
+		pending.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		pending.slices.swap( mFreed );
+		mPending.push_back( pending );
+	}
+	
+	void BufferArena::_reclaim()
+	{
+		while( !mPending.empty() )
+		{
+			PendingFree& pending = mPending.front();
+			GLenum status = glClientWaitSync( pending.fence, 0, 0 );
+			if( status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED ) break;
+			
+			for( auto it = pending.slices.begin(); it != pending.slices.end(); ++it )
+			{
+				_release( it->first, it->second );
+			}
+			glDeleteSync( pending.fence );
+			mPending.pop_front();
+		}
+	}
+	
+	void BufferArena::_release( size_t offset, size_t size )
+	{
+		auto next = mFree.lower_bound( offset );
+		
+		// Merge with the slice after this one.
+		if( next != mFree.end() && offset + size == next->first )
+		{
+			size += next->second;
+			next = mFree.erase( next );
+		}
+		
+		// Merge with the slice before this one.
+		if( next != mFree.begin() )
+		{
+			auto prev = next;
+			--prev;
+			if( prev->first + prev->second == offset )
+			{
+				prev->second += size;
+				return;
+			}
+		}
+		
+		mFree.insert( next, std::make_pair( offset, size ) );
+	}
+	
+	GLuint BufferArena::getName()
+	{
+		return mBuffer;
+	}
+	
+	size_t BufferArena::getUsedSize()
+	{
+		return mUsed;
+	}
+	
+	size_t BufferArena::getCapacity()
+	{
+		return mCapacity;
+	}
+};
@@ -1,4 +1,5 @@
 #include "Geometry.h"
+#include "BufferArena.h"
 #include <ProgramResource.h>
 
 Geometry::Geometry()
@@ -64,6 +65,8 @@ TerrainVertex Geometry::terrainVertex(float x, float y, float z, float u, float
 	vert.u0 = (GLubyte)u;
 	vert.v0 = (GLubyte)v;
 	vert.l = (GLubyte)(l*255);
+	vert.f = 0;
+	vert.ao = 0;
 	return vert;
 }
 
@@ -110,16 +113,60 @@ void MeshGeometry::bindVertexAttributes( ProgramResource* program )
 }
 
 TerrainGeometry::TerrainGeometry()
-: vertexData(nullptr)
+: vertexData(nullptr),
+vertexArena(nullptr),
+edgeArena(nullptr),
+vertexOffset(0),
+edgeOffset(0)
 {
 	
 }
 
 TerrainGeometry::~TerrainGeometry()
 {
+	// ~Geometry would only release the geometry's own buffers.
+	releaseBuffer();
 	delete[] vertexData;
 }
 
+bool TerrainGeometry::bindToArena( Magnetite::BufferArena* vertices, Magnetite::BufferArena* edges )
+{
+	size_t vertexSize = sizeof(TerrainVertex)*this->vertexCount;
+	size_t edgeSize = sizeof(GLedge)*this->edgeCount;
+	
+	if( !vertices->allocate( vertexSize, this->vertexOffset ) ) return false;
+	if( !edges->allocate( edgeSize, this->edgeOffset ) )
+	{
+		vertices->free( this->vertexOffset, vertexSize );
+		return false;
+	}
+	
+	vertices->upload( this->vertexOffset, this->vertexData, vertexSize );
+	edges->upload( this->edgeOffset, this->edgeData, edgeSize );
+	
+	this->vertexArena = vertices;
+	this->edgeArena = edges;
+	return true;
+}
+
+bool TerrainGeometry::isUploaded()
+{
+	return this->vertexArena != nullptr || ( this->vertexBO != 0 && this->indexBO != 0 );
+}
+
+void TerrainGeometry::releaseBuffer()
+{
+	if( this->vertexArena != nullptr )
+	{
+		this->vertexArena->free( this->vertexOffset, sizeof(TerrainVertex)*this->vertexCount );
+		this->edgeArena->free( this->edgeOffset, sizeof(GLedge)*this->edgeCount );
+		this->vertexArena = nullptr;
+		this->edgeArena = nullptr;
+	}
+	
+	Geometry::releaseBuffer();
+}
+
 void TerrainGeometry::bindToBuffer()
 {
 	if( this->vertexBO == 0 )
@@ -138,7 +185,14 @@ void TerrainGeometry::bindToBuffer()
 
 void TerrainGeometry::bindVertexAttributes( ProgramResource* program)
 {
-	program->setVertexAttribute("in_vertex", 3, GL_FLOAT, GL_FALSE, sizeof(TerrainVertex), BUFFER_OFFSET(0) );
+	bindTerrainAttributes( program );
+}
+
+void TerrainGeometry::bindTerrainAttributes( ProgramResource* program )
+{
+	// Position and face.
+	program->setVertexAttribute("in_vertex", 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(TerrainVertex), BUFFER_OFFSET(0) );
 	
-	program->setVertexAttribute("in_params", 3, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(TerrainVertex), BUFFER_OFFSET(12) );
+	// Tile, light and ambient occlusion.
+	program->setVertexAttribute("in_params", 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(TerrainVertex), BUFFER_OFFSET(4) );
 }
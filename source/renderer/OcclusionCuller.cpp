@@ -0,0 +1,134 @@
+#include "OcclusionCuller.h"
+#include "Geometry.h"
+
+namespace Magnetite
+{
+	/**
+	 * Boxes are grown by this much so they sit in front of the faces on the
+	 * edge of the geometry rather than failing the depth test against them.
+	 */
+	static const float BoxPadding = 0.5f;
+	
+	static const GLfloat BoxVertices[] = {
+		0, 0, 0,  1, 0, 0,  1, 1, 0,  0, 1, 0,
+		0, 0, 1,  1, 0, 1,  1, 1, 1,  0, 1, 1
+	};
+	
+	static const GLubyte BoxIndices[] = {
+		0, 1, 2,  0, 2, 3, // -z
+		4, 6, 5,  4, 7, 6, // +z
+		0, 4, 5,  0, 5, 1, // -y
+		3, 2, 6,  3, 6, 7, // +y
+		0, 3, 7,  0, 7, 4, // -x
+		1, 5, 6,  1, 6, 2  // +x
+	};
+	
+	OcclusionCuller::OcclusionCuller()
+	: mQueryTarget( GL_SAMPLES_PASSED ),
+	mFrame( 0 )
+	{
+		if( GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2 )
+		{
+			mQueryTarget = GL_ANY_SAMPLES_PASSED;
+		}
+	}
+	
+	OcclusionCuller::~OcclusionCuller()
+	{
+		for( auto it = mQueries.begin(); it != mQueries.end(); ++it )
+		{
+			if( it->second.query != 0 ) glDeleteQueries( 1, &it->second.query );
+		}
+	}
+	
+	bool OcclusionCuller::isVisible( const Geometry* geom, const Vector3& min, const Vector3& max, const Vector3& eye )
+	{
+		auto it = mQueries.find( geom );
+		if( it == mQueries.end() )
+		{
+			// Spread the re-tests of visible geometry over the interval.
+			GeometryQuery state = { 0, false, false, mFrame - mQueries.size() % VisibleRetestInterval };
+			it = mQueries.insert( std::make_pair( geom, state ) ).first;
+		}
+		GeometryQuery& state = it->second;
+		
+		if( state.pending )
+		{
+			GLuint available = 0;
+			glGetQueryObjectuiv( state.query, GL_QUERY_RESULT_AVAILABLE, &available );
+			if( available )
+			{
+				GLuint samples = 0;
+				glGetQueryObjectuiv( state.query, GL_QUERY_RESULT, &samples );
+				state.occluded = samples == 0;
+				state.pending = false;
+			}
+		}
+		
+		// The near plane would clip the box around the camera.
+		Vector3 lo = min - Vector3( 1.f + BoxPadding );
+		Vector3 hi = max + Vector3( 1.f + BoxPadding );
+		if( eye.x > lo.x && eye.y > lo.y && eye.z > lo.z && eye.x < hi.x && eye.y < hi.y && eye.z < hi.z )
+		{
+			state.occluded = false;
+			return true;
+		}
+		
+		if( !state.pending && ( state.occluded || mFrame - state.lastTest >= VisibleRetestInterval ) )
+		{
+			if( state.query == 0 ) glGenQueries( 1, &state.query );
+			
+			QueuedTest test = { state.query, min - Vector3( BoxPadding ), max + Vector3( BoxPadding ) };
+			mTests.push_back( test );
+			state.pending = true;
+			state.lastTest = mFrame;
+		}
+		
+		return !state.occluded;
+	}
+	
+	void OcclusionCuller::runQueries()
+	{
+		mFrame++;
+		if( mTests.empty() ) return;
+		
+		glColorMask( GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE );
+		glDepthMask( GL_FALSE );
+		glDisable( GL_CULL_FACE );
+		
+		glEnableClientState( GL_VERTEX_ARRAY );
+		glVertexPointer( 3, GL_FLOAT, 0, BoxVertices );
+		
+		glMatrixMode( GL_MODELVIEW );
+		for( auto it = mTests.begin(); it != mTests.end(); ++it )
+		{
+			Vector3 size = it->max - it->min;
+			glPushMatrix();
+			glTranslatef( it->min.x, it->min.y, it->min.z );
+			glScalef( size.x, size.y, size.z );
+			
+			glBeginQuery( mQueryTarget, it->query );
+			glDrawElements( GL_TRIANGLES, sizeof( BoxIndices ), GL_UNSIGNED_BYTE, BoxIndices );
+			glEndQuery( mQueryTarget );
+			
+			glPopMatrix();
+		}
+		
+		glDisableClientState( GL_VERTEX_ARRAY );
+		
+		glEnable( GL_CULL_FACE );
+		glDepthMask( GL_TRUE );
+		glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+		
+		mTests.clear();
+	}
+	
+	void OcclusionCuller::release( const Geometry* geom )
+	{
+		auto it = mQueries.find( geom );
+		if( it == mQueries.end() ) return;
+		
+		if( it->second.query != 0 ) glDeleteQueries( 1, &it->second.query );
+		mQueries.erase( it );
+	}
+};